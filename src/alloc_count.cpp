@@ -0,0 +1,51 @@
+#include "alloc_count.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> Allocations(0);
+std::atomic<uint64_t> Bytes(0);
+
+void *allocate(std::size_t Size) noexcept {
+  Allocations.fetch_add(1, std::memory_order_relaxed);
+  Bytes.fetch_add(Size, std::memory_order_relaxed);
+  // Every call must return a distinct pointer, even for zero bytes.
+  return std::malloc(Size ? Size : 1);
+}
+
+} // end anonymous namespace
+
+uint64_t allocationCount() {
+  return Allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t allocatedBytes() { return Bytes.load(std::memory_order_relaxed); }
+
+void *operator new(std::size_t Size) {
+  if (void *P = allocate(Size)) {
+    return P;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t Size) { return operator new(Size); }
+
+void *operator new(std::size_t Size, const std::nothrow_t &) noexcept {
+  return allocate(Size);
+}
+
+void *operator new[](std::size_t Size, const std::nothrow_t &) noexcept {
+  return allocate(Size);
+}
+
+void operator delete(void *P) noexcept { std::free(P); }
+void operator delete[](void *P) noexcept { std::free(P); }
+void operator delete(void *P, std::size_t) noexcept { std::free(P); }
+void operator delete[](void *P, std::size_t) noexcept { std::free(P); }
+void operator delete(void *P, const std::nothrow_t &) noexcept { std::free(P); }
+void operator delete[](void *P, const std::nothrow_t &) noexcept {
+  std::free(P);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations, so that code which must not allocate, like the
+// frame loop, can check that it does not. Counting replaces the global
+// operator new, for every thread at once, and costs a relaxed atomic add
+// per allocation. The replacement is compiled into the programs that list
+// alloc_count.cpp among their sources, tetris and tetris_tests, and no
+// others; tetris_core does not carry it.
+
+// Allocations made through operator new since the program started.
+uint64_t allocationCount();
+// Bytes asked for by those allocations.
+uint64_t allocatedBytes();
@@ -0,0 +1,523 @@
+#include "autoplayer.h"
+
+#include <bitset>
+#include <cassert>
+#include <cstdlib>
+#include <vector>
+
+#include "board_features.h"
+#include "transposition.h"
+
+namespace {
+
+struct State {
+  int8_t X, Y;
+  uint8_t Rotation;
+
+  bool operator==(const State &Other) const {
+    return X == Other.X && Y == Other.Y && Rotation == Other.Rotation;
+  }
+};
+
+// Every position that fits on a Board lies within these bounds, so they
+// cover every state the search can reach.
+template <typename Board> struct StateSpace {
+  static const int MinX = -Board::WallBits;
+  static const int MaxX = Board::Cols - 1;
+  static const int NumX = MaxX - MinX + 1;
+  static const int NumY = Board::Rows + 1;
+  static const int NumStates = 4 * NumX * NumY;
+
+  static int index(State S) {
+    return (S.Rotation * NumY + S.Y) * NumX + (S.X - MinX);
+  }
+};
+
+// Room for two pieces' placements at a couple of heights in every column
+// and rotation, which play seldom goes past, so that it rarely allocates.
+template <typename Board> size_t typicalLeaves() {
+  return 2 * 2 * 4 * Board::Cols;
+}
+
+// A placement's score from the features of the board it leaves.
+double weigh(const AutoplayerWeights &W, int AggregateHeight, unsigned Lines,
+             int Holes, int Bumpiness) {
+  return W.AggregateHeight * AggregateHeight + W.Lines * Lines +
+         W.Holes * Holes + W.Bumpiness * Bumpiness;
+}
+
+// Scores the boards left by the placements a search does not look past,
+// which is most of what it scores. Boards are added as the search finds
+// them and scored together once it is done. Only the standard board has
+// batched feature kernels, so other sizes score each board as it is added,
+// with Evaluate.
+template <typename Board> class LeafScores {
+public:
+  LeafScores() { Scores.reserve(typicalLeaves<Board>()); }
+  void clear() { Scores.clear(); }
+  template <typename F>
+  void add(const Board &, unsigned, F Evaluate) {
+    Scores.push_back(Evaluate());
+  }
+  void evaluate(const AutoplayerWeights &) {}
+  size_t size() const { return Scores.size(); }
+  double get(size_t Index) const { return Scores[Index]; }
+
+private:
+  std::vector<double> Scores;
+};
+
+template <> class LeafScores<Board> {
+public:
+  LeafScores() {
+    Batch.reserve(typicalLeaves<Board>());
+    Lines.reserve(typicalLeaves<Board>());
+    Scores.reserve(typicalLeaves<Board>());
+  }
+  void clear() {
+    Batch.clear();
+    Lines.clear();
+  }
+  template <typename F> void add(const Board &Grid, unsigned Cleared, F) {
+    Batch.add(Grid);
+    Lines.push_back(Cleared);
+  }
+  void evaluate(const AutoplayerWeights &W) {
+    Batch.evaluate();
+    Scores.resize(Lines.size());
+    for (size_t i = 0, E = Lines.size(); i != E; ++i) {
+      int AggregateHeight = 0;
+      for (int Col = 0; Col < Board::Cols; ++Col) {
+        AggregateHeight += Batch.getHeight(i, Col);
+      }
+      Scores[i] = weigh(W, AggregateHeight, Lines[i], Batch.getHoles(i),
+                        Batch.getBumpiness(i));
+    }
+  }
+  size_t size() const { return Lines.size(); }
+  double get(size_t Index) const { return Scores[Index]; }
+
+private:
+  BoardFeatureBatch Batch;
+  std::vector<unsigned> Lines;
+  std::vector<double> Scores;
+};
+
+// What one placement search works in. At NumStates entries each, these
+// run to hundreds of kilobytes on the largest boards.
+template <typename Board> struct SearchScratch {
+  typedef StateSpace<Board> Space;
+  std::bitset<Space::NumStates> Seen;
+  State Seeds[Space::NumStates];
+  State Queue[Space::NumStates];
+  Action First[Space::NumStates];
+  LeafScores<Board> Leaves;
+};
+
+const Action Moves[] = {
+  Action::MoveLeft, Action::MoveRight, Action::RotateLeft,
+  Action::RotateRight, Action::SoftDrop,
+};
+
+State applyMove(State S, Action A, uint8_t NumRotations) {
+  switch (A) {
+  case Action::MoveLeft:
+    S.X--;
+    break;
+  case Action::MoveRight:
+    S.X++;
+    break;
+  case Action::RotateLeft:
+    S.Rotation = S.Rotation == 0 ? NumRotations - 1 : S.Rotation - 1;
+    break;
+  case Action::RotateRight:
+    S.Rotation = S.Rotation + 1 == NumRotations ? 0 : S.Rotation + 1;
+    break;
+  default:
+    S.Y++;
+    break;
+  }
+  return S;
+}
+
+// Breadth-first search over every state the piece can be moved to from the
+// seed states with the game's inputs, following the same rules as
+// TetrisGame: a move only happens if the piece fits afterwards. Visit is
+// called with each state and the first input of a shortest path to it from
+// a seed (HardDrop for the seeds themselves), and stops the search by
+// returning true. Without AllowDown the piece only moves sideways and
+// rotates.
+template<typename Board, typename F>
+void search(const Board &Grid, Tetromino::Kind Kind, uint8_t NumRotations,
+            const State *Seeds, int NumSeeds, bool AllowDown,
+            SearchScratch<Board> &Scratch, F Visit) {
+  typedef StateSpace<Board> Space;
+  std::bitset<Space::NumStates> &Seen = Scratch.Seen;
+  State *Queue = Scratch.Queue;
+  Action *First = Scratch.First;
+  Seen.reset();
+  int Head = 0, Tail = 0;
+
+  for (int i = 0; i < NumSeeds; ++i) {
+    Seen.set(Space::index(Seeds[i]));
+    Queue[Tail] = Seeds[i];
+    First[Tail++] = Action::HardDrop;
+  }
+
+  int NumMoves = AllowDown ? 5 : 4;
+  while (Head < Tail) {
+    State S = Queue[Head];
+    Action FirstMove = First[Head++];
+    if (Visit(S, FirstMove)) {
+      return;
+    }
+    for (int i = 0; i < NumMoves; ++i) {
+      State Next = applyMove(S, Moves[i], NumRotations);
+      if (Seen.test(Space::index(Next)) ||
+          !Grid.fits(SHAPES[Kind][Next.Rotation], Next.X, Next.Y)) {
+        continue;
+      }
+      Seen.set(Space::index(Next));
+      Queue[Tail] = Next;
+      First[Tail++] = Head <= NumSeeds ? Moves[i] : FirstMove;
+    }
+  }
+}
+
+// Calls Visit with every resting place the piece can reach from Start.
+// Visit must not search with Scratch, as the search is still running.
+template<typename Board, typename F>
+void forEachPlacement(const Board &Grid, Tetromino Piece, Point Start,
+                      SearchScratch<Board> &Scratch, F Visit) {
+  Tetromino::Kind Kind = Piece.getKind();
+  uint8_t NumRotations = Piece.getNumRotations();
+
+  State *Seeds = Scratch.Seeds;
+  int NumSeeds = 0;
+  Seeds[NumSeeds++] = {int8_t(Start.x), int8_t(Start.y), Piece.getRotation()};
+
+  // Above BandBottom every row a piece covers is empty, so which sideways
+  // moves and rotations are possible does not depend on the height, and
+  // any state there can drop straight to BandBottom. Rather than searching
+  // the whole empty band, gather what is reachable at the starting height
+  // and carry on from BandBottom.
+  int TopRow = 0;
+  while (TopRow < Board::Rows && !Grid.getRow(TopRow)) {
+    ++TopRow;
+  }
+  int BandBottom = TopRow - 4;
+  if (Start.y < BandBottom) {
+    State Initial = Seeds[0];
+    NumSeeds = 0;
+    search(Grid, Kind, NumRotations, &Initial, 1, false, Scratch,
+           [&](State S, Action) {
+      S.Y = BandBottom;
+      Seeds[NumSeeds++] = S;
+      return false;
+    });
+  }
+
+  search(Grid, Kind, NumRotations, Seeds, NumSeeds, true, Scratch,
+         [&](State S, Action) {
+    if (!Grid.fits(SHAPES[Kind][S.Rotation], S.X, S.Y + 1)) {
+      Visit(Tetromino(Kind, S.Rotation), Point{S.X, S.Y});
+    }
+    return false;
+  });
+}
+
+const double GameOverScore = -1e9;
+
+// The keys of the cells a piece fills at Pos.
+uint64_t zobristPiece(Tetromino Piece, Point Pos) {
+  const Tetromino::Shape &Shape = Piece.getShape();
+  uint64_t Hash = 0;
+  for (int i = 0; i < 4; ++i) {
+    Hash ^= zobristCell(Pos.y + Shape.CellY[i], Pos.x + Shape.CellX[i]);
+  }
+  return Hash;
+}
+
+// Places a piece as the game would and returns the rows it clears.
+template <typename Board>
+unsigned lock(Board &Grid, Tetromino Piece, Point Pos) {
+  const Tetromino::Shape &Shape = Piece.getShape();
+  Grid.place(Piece, Pos.x, Pos.y);
+  return Grid.clearFullRows(Pos.y + Shape.MinY, Pos.y + Shape.MaxY);
+}
+
+} // end anonymous namespace
+
+template <int NumRows, int NumCols>
+struct BasicAutoplayer<NumRows, NumCols>::SearchBuffers {
+  // choose() and firstActionToward() search at level 0. The lookahead is
+  // at most two placements deep, and searches at level Levels - Depth, so
+  // that each placement it makes searches at the level after its own.
+  static const int Levels = 3;
+  SearchScratch<Board> Level[Levels];
+  // The placements choose() scores together, in the order found.
+  std::vector<Placement> Candidates;
+
+  SearchBuffers() { Candidates.reserve(typicalLeaves<Board>()); }
+};
+
+template <int NumRows, int NumCols>
+BasicAutoplayer<NumRows, NumCols>::BasicAutoplayer(const Options &Opts)
+    : Opts(Opts), Target{Tetromino(Tetromino::NumKinds), Point{0, 0}, false, 0},
+      TargetPiece(0), HasTarget(false), HeldForTarget(false),
+      Buffers(new SearchBuffers) {}
+
+template <int NumRows, int NumCols>
+BasicAutoplayer<NumRows, NumCols>::~BasicAutoplayer() {}
+
+template <int NumRows, int NumCols>
+double BasicAutoplayer<NumRows, NumCols>::evaluate(const Board &Grid,
+                                             unsigned Lines) const {
+  int Heights[Board::Cols] = {};
+  int Holes = 0;
+  uint64_t Covered = 0;
+  for (int Row = 0; Row < Board::Rows; ++Row) {
+    uint64_t Cells = Grid.getRow(Row);
+    for (uint64_t Tops = Cells & ~Covered; Tops; Tops &= Tops - 1) {
+      Heights[__builtin_ctzll(Tops)] = Board::Rows - Row;
+    }
+    Holes += __builtin_popcountll(Covered & ~Cells);
+    Covered |= Cells;
+  }
+
+  int AggregateHeight = 0, Bumpiness = 0;
+  for (int Col = 0; Col < Board::Cols; ++Col) {
+    AggregateHeight += Heights[Col];
+    if (Col > 0) {
+      Bumpiness += std::abs(Heights[Col] - Heights[Col - 1]);
+    }
+  }
+  return weigh(Opts.Scoring, AggregateHeight, Lines, Holes, Bumpiness);
+}
+
+template <int NumRows, int NumCols>
+double BasicAutoplayer<NumRows, NumCols>::bestValue(
+    const Board &Grid, uint64_t GridHash, Tetromino Active, Tetromino Held,
+    unsigned Lines, int Depth, bool Hold) const {
+  bool CanSwap = Hold && Held.isValid();
+  if (Depth == 0 || (!Active.isValid() && !CanSwap)) {
+    return evaluate(Grid, Lines);
+  }
+  Point Spawn = {TetrisGame::SpawnX, TetrisGame::SpawnY};
+  if (Active.isValid() && !Grid.fits(Active.getShape(), Spawn.x, Spawn.y)) {
+    return GameOverScore;
+  }
+
+  uint64_t Key = GridHash ^ zobristActive(Active) ^ zobristHeld(Held) ^
+                 zobristExtra(Lines) ^ zobristExtra(32 + Depth) ^
+                 (Hold ? zobristExtra(64) : 0);
+  double Best = GameOverScore;
+  if (Opts.Table && Opts.Table->probe(Key, Best)) {
+    return Best;
+  }
+
+  assert(Depth < SearchBuffers::Levels);
+  SearchScratch<Board> &Scratch =
+      Buffers->Level[SearchBuffers::Levels - Depth];
+  LeafScores<Board> &Leaves = Scratch.Leaves;
+  Leaves.clear();
+  // Whatever comes after the pieces placed here is not known yet.
+  auto placeAll = [&](Tetromino Piece, Tetromino NewHeld) {
+    forEachPlacement(Grid, Piece, Spawn, Scratch,
+                     [&](Tetromino Placed, Point Pos) {
+      Board After = Grid;
+      unsigned Cleared = lock(After, Placed, Pos);
+      if (Depth == 1) {
+        Leaves.add(After, Lines + Cleared,
+                   [&] { return evaluate(After, Lines + Cleared); });
+        return;
+      }
+      uint64_t AfterHash = 0;
+      if (Opts.Table) {
+        AfterHash = Cleared ? zobristBoard(After)
+                            : GridHash ^ zobristPiece(Placed, Pos);
+      }
+      double Score =
+          bestValue(After, AfterHash, Tetromino(Tetromino::NumKinds), NewHeld,
+                    Lines + Cleared, Depth - 1, Hold);
+      if (Score > Best) {
+        Best = Score;
+      }
+    });
+  };
+  if (Active.isValid()) {
+    placeAll(Active, Held);
+  }
+  if (CanSwap && Grid.fits(Held.getShape(), Spawn.x, Spawn.y)) {
+    placeAll(Held, Active);
+  }
+  Leaves.evaluate(Opts.Scoring);
+  for (size_t i = 0, E = Leaves.size(); i != E; ++i) {
+    if (Leaves.get(i) > Best) {
+      Best = Leaves.get(i);
+    }
+  }
+
+  if (Opts.Table) {
+    Opts.Table->store(Key, Best);
+  }
+  return Best;
+}
+
+template <int NumRows, int NumCols>
+Placement
+BasicAutoplayer<NumRows, NumCols>::choose(const TetrisGame &Game) const {
+  return choose(Game, Opts.UseHold);
+}
+
+template <int NumRows, int NumCols>
+Placement BasicAutoplayer<NumRows, NumCols>::choose(const TetrisGame &Game,
+                                                bool UseHold) const {
+  const Board &Grid = Game.getBoard();
+  Point Pos = Game.getCurrentPos();
+
+  Placement Best = {Game.getCurrent(), Game.downDestination(), false,
+                    GameOverScore};
+  bool Found = false;
+  auto pick = [&](const Placement &P) {
+    if (!Found || P.Score > Best.Score) {
+      Best = P;
+      Found = true;
+    }
+  };
+
+  // Without the lookahead, every placement is scored together at the end.
+  SearchScratch<Board> &Scratch = Buffers->Level[0];
+  std::vector<Placement> &Candidates = Buffers->Candidates;
+  Scratch.Leaves.clear();
+  Candidates.clear();
+
+  // The pieces in play and held after each placement, for the lookahead.
+  auto consider = [&](Tetromino Piece, bool Hold, Tetromino FollowUp,
+                      Tetromino HeldAfter) {
+    forEachPlacement(Grid, Piece, Pos, Scratch,
+                     [&](Tetromino Placed, Point At) {
+      Board After = Grid;
+      unsigned Cleared = lock(After, Placed, At);
+      if (!Opts.Lookahead) {
+        Candidates.push_back(Placement{Placed, At, Hold, 0});
+        Scratch.Leaves.add(After, Cleared,
+                           [&] { return evaluate(After, Cleared); });
+        return;
+      }
+      pick(Placement{Placed, At, Hold,
+                     bestValue(After, Opts.Table ? zobristBoard(After) : 0,
+                               FollowUp, HeldAfter, Cleared,
+                               Opts.LookaheadHold ? 2 : 1,
+                               Opts.LookaheadHold)});
+    });
+  };
+
+  consider(Game.getCurrent(), false, Game.getNext(), Game.getSaved());
+
+  if (UseHold) {
+    // Mirrors TetrisGame's hold: with nothing held, the next piece comes in
+    // and a new, unknown one follows it; otherwise the pieces swap unless
+    // the held one does not fit.
+    Tetromino Saved = Game.getSaved();
+    if (!Saved.isValid()) {
+      Tetromino Next = Game.getNext();
+      if (Grid.fits(Next.getShape(), Pos.x, Pos.y)) {
+        consider(Next, true, Tetromino(Tetromino::NumKinds),
+                 Game.getCurrent());
+      }
+    } else if (Grid.fits(Saved.getShape(), Pos.x, Pos.y)) {
+      consider(Saved, true, Game.getNext(), Game.getCurrent());
+    }
+  }
+
+  Scratch.Leaves.evaluate(Opts.Scoring);
+  for (size_t i = 0, E = Candidates.size(); i != E; ++i) {
+    Candidates[i].Score = Scratch.Leaves.get(i);
+    pick(Candidates[i]);
+  }
+  return Best;
+}
+
+template <int NumRows, int NumCols>
+Action BasicAutoplayer<NumRows, NumCols>::firstActionToward(
+    const TetrisGame &Game) const {
+  Tetromino Current = Game.getCurrent();
+  if (Current.getKind() != Target.Piece.getKind()) {
+    return Action::NumActions;
+  }
+
+  const Board &Grid = Game.getBoard();
+  const Tetromino::Shape &Shape = Target.Piece.getShape();
+  State Goal = {int8_t(Target.Pos.x), int8_t(Target.Pos.y),
+                Target.Piece.getRotation()};
+  Point Start = Game.getCurrentPos();
+  State Initial = {int8_t(Start.x), int8_t(Start.y), Current.getRotation()};
+  Action Result = Action::NumActions;
+  search(Grid, Current.getKind(), Current.getNumRotations(), &Initial, 1,
+         true, Buffers->Level[0], [&](State S, Action First) {
+    if (S.X != Goal.X || S.Rotation != Goal.Rotation || S.Y > Goal.Y) {
+      return false;
+    }
+    // Hard dropping from here has to land exactly on the goal.
+    int Y = S.Y;
+    while (Y < Goal.Y && Grid.fits(Shape, S.X, Y + 1)) {
+      ++Y;
+    }
+    if (Y != Goal.Y || Grid.fits(Shape, S.X, Y + 1)) {
+      return false;
+    }
+    Result = First;
+    return true;
+  });
+  return Result;
+}
+
+template <int NumRows, int NumCols>
+Action BasicAutoplayer<NumRows, NumCols>::nextAction(const TetrisGame &Game) {
+  if (!HasTarget || TargetPiece != Game.getPiecesPlaced()) {
+    Target = choose(Game, Opts.UseHold);
+    TargetPiece = Game.getPiecesPlaced();
+    HasTarget = true;
+    HeldForTarget = false;
+  }
+
+  if (Target.Hold && !HeldForTarget) {
+    HeldForTarget = true;
+    return Action::Hold;
+  }
+
+  Action Result = firstActionToward(Game);
+  if (Result == Action::NumActions) {
+    // Gravity carried the piece somewhere the goal cannot be reached from.
+    // Choose again from where it is now, without holding again.
+    Target = choose(Game, false);
+    Result = firstActionToward(Game);
+  }
+  return Result == Action::NumActions ? Action::HardDrop : Result;
+}
+
+template <int NumRows, int NumCols>
+void BasicAutoplayer<NumRows, NumCols>::playPiece(TetrisGame &Game) {
+  uint64_t Piece = Game.getPiecesPlaced();
+  // Always choose afresh, as a target left from another game can be for a
+  // piece with the same number.
+  HasTarget = false;
+  // Enough inputs to cross the board and come back, fall its full height
+  // and turn at every step of the way, which no placement needs; the limit
+  // only guards against the search and the game ever disagreeing.
+  const int MaxInputs = 2 * (NumRows + NumCols) + 16;
+  for (int i = 0; i < MaxInputs; ++i) {
+    if (Game.isGameOver() || Game.isPaused() ||
+        Game.getPiecesPlaced() != Piece) {
+      return;
+    }
+    Game.apply(nextAction(Game));
+  }
+  Game.apply(Action::HardDrop);
+}
+
+#define TETRIS_AUTOPLAYER(Rows, Cols)                                          \
+  template class BasicAutoplayer<Rows, Cols>;
+TETRIS_BOARD_SIZES(TETRIS_AUTOPLAYER)
+#undef TETRIS_AUTOPLAYER
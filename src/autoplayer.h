@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "board.h"
+#include "game.h"
+
+class TranspositionTable;
+
+// A final resting place for a piece.
+struct Placement {
+  Tetromino Piece;
+  Point Pos;
+  // Whether the piece has to be swapped in with Hold first.
+  bool Hold;
+  double Score;
+};
+
+// Weights of each board feature in a placement's score. The defaults are
+// the well-known ones from Yiyuan Lee's genetic tuning.
+struct AutoplayerWeights {
+  // Sum of column heights.
+  double AggregateHeight = -0.510066;
+  // Rows cleared by the placement.
+  double Lines = 0.760666;
+  // Empty cells with a filled cell somewhere above them.
+  double Holes = -0.35663;
+  // Sum of height differences between neighbouring columns.
+  double Bumpiness = -0.184483;
+};
+
+struct AutoplayerOptions {
+  AutoplayerWeights Scoring;
+  // Also consider swapping in the held piece (or the next one, when
+  // nothing is held yet).
+  bool UseHold = true;
+  // Score each placement by the best placement of Next after it.
+  bool Lookahead = true;
+  // Let the lookahead hold as well, placing the current, next and held
+  // pieces in every order holding allows: three pieces deep rather than
+  // two once something is held. Different orders often lead to the same
+  // board, which Table saves scoring twice.
+  bool LookaheadHold = false;
+  // Remembers lookahead scores across searches, and across threads. It
+  // must only be shared by players with the same weights. Optional.
+  TranspositionTable *Table = nullptr;
+};
+
+// Plays a TetrisGame by searching every placement the current piece can
+// reach, and optionally the held piece, scoring the resulting boards with a
+// weighted sum of simple features, and steering the piece to the best one.
+// Each thread needs a player of its own.
+template <int NumRows, int NumCols> class BasicAutoplayer {
+public:
+  typedef BasicBoard<NumRows, NumCols> Board;
+  typedef BasicTetrisGame<NumRows, NumCols> TetrisGame;
+  typedef AutoplayerWeights Weights;
+  typedef AutoplayerOptions Options;
+
+  BasicAutoplayer() : BasicAutoplayer(Options()) {}
+  explicit BasicAutoplayer(const Options &Opts);
+  ~BasicAutoplayer();
+
+  // Picks the best placement for the game's current piece.
+  Placement choose(const TetrisGame &Game) const;
+
+  // Returns the next input to apply toward the chosen placement for the
+  // current piece, choosing one first if this is a new piece. Works from
+  // the game's actual state, so it recovers when gravity moves the piece
+  // between calls.
+  Action nextAction(const TetrisGame &Game);
+
+  // Plays the current piece all the way down in one go.
+  void playPiece(TetrisGame &Game);
+
+  // Scores a board after a placement that cleared Lines rows.
+  double evaluate(const Board &Grid, unsigned Lines) const;
+
+private:
+  Options Opts;
+
+  // The placement being steered toward, and the piece it is for.
+  Placement Target;
+  uint64_t TargetPiece;
+  bool HasTarget;
+  bool HeldForTarget;
+
+  // Queues for the placement searches, one set for each search that can be
+  // running at once as the lookahead nests them. They are allocated with
+  // the player, as on large boards they are too big to keep on the stack,
+  // which makes a player unsafe to use from two threads at once.
+  struct SearchBuffers;
+  std::unique_ptr<SearchBuffers> Buffers;
+
+  Placement choose(const TetrisGame &Game, bool UseHold) const;
+  // The best score reachable from Grid, which hashes to GridHash, with up
+  // to Depth more placements, and Lines cleared so far. Active is the piece
+  // in play and Held the one in the hold slot; either is NumKinds when it
+  // is not known. Hold lets the held piece be swapped in.
+  double bestValue(const Board &Grid, uint64_t GridHash, Tetromino Active,
+                   Tetromino Held, unsigned Lines, int Depth,
+                   bool Hold) const;
+  // Returns NumActions if the target cannot be reached.
+  Action firstActionToward(const TetrisGame &Game) const;
+};
+
+typedef BasicAutoplayer<Board::Rows, Board::Cols> Autoplayer;
+
+#define TETRIS_EXTERN_AUTOPLAYER(Rows, Cols)                                   \
+  extern template class BasicAutoplayer<Rows, Cols>;
+TETRIS_BOARD_SIZES(TETRIS_EXTERN_AUTOPLAYER)
+#undef TETRIS_EXTERN_AUTOPLAYER
@@ -0,0 +1,568 @@
+// Microbenchmarks for the hot paths of the game rules, run against pinned
+// board fixtures so that numbers stay comparable from one change to the
+// next. Prints one JSON document to stdout.
+//
+// Usage: tetris_bench [--min-time SECONDS] [--filter SUBSTRING]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "autoplayer.h"
+#include "board.h"
+#include "board_features.h"
+#include "fixtures.h"
+#include "frame_capture.h"
+#include "game.h"
+#include "high_scores.h"
+#include "sim_clock.h"
+#include "tetromino.h"
+#include "transposition.h"
+#include "triple_buffer.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Keeps the compiler from discarding work whose result is otherwise unused.
+template <typename T> void keep(const T &Value) {
+  asm volatile("" : : "r"(&Value) : "memory");
+}
+
+struct Result {
+  std::string Name;
+  std::string Fixture;
+  double NsPerOp;
+  uint64_t Ops;
+};
+
+double MinTime = 0.2;
+std::string Filter;
+std::vector<Result> Results;
+
+// Times Batch(), which performs OpsPerBatch operations, until MinTime has
+// passed and records the fastest batch, which is the one least disturbed
+// by the rest of the system. Setup() runs untimed before every batch.
+template <typename Fn, typename SetupFn>
+void run(const std::string &Name, const std::string &Fixture,
+         uint64_t OpsPerBatch, Fn Batch, SetupFn Setup) {
+  if ((Name + "/" + Fixture).find(Filter) == std::string::npos) {
+    return;
+  }
+  double Best = 1e300;
+  uint64_t Ops = 0;
+  Clock::time_point End =
+      Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double>(MinTime));
+  do {
+    Setup();
+    Clock::time_point Start = Clock::now();
+    Batch();
+    double Ns = std::chrono::duration<double, std::nano>(Clock::now() - Start)
+                    .count();
+    Best = std::min(Best, Ns / OpsPerBatch);
+    Ops += OpsPerBatch;
+  } while (Clock::now() < End);
+  Results.push_back({Name, Fixture, Best, Ops});
+}
+
+template <typename Fn>
+void run(const std::string &Name, const std::string &Fixture,
+         uint64_t OpsPerBatch, Fn Batch) {
+  run(Name, Fixture, OpsPerBatch, Batch, [] {});
+}
+
+// Fixtures are drawn bottom-up: Picture[0] is the bottom row, '#' a filled
+// cell and anything else an empty one.
+Board makeBoard(std::initializer_list<const char *> Picture) {
+  Board Grid;
+  int Row = Board::Rows - 1;
+  for (const char *Line : Picture) {
+    for (int Col = 0; Col < Board::Cols && Line[Col]; ++Col) {
+      if (Line[Col] == '#') {
+        Grid.setCell(Row, Col, Tetromino::T);
+      }
+    }
+    --Row;
+  }
+  return Grid;
+}
+
+struct Fixture {
+  const char *Name;
+  Board Grid;
+};
+
+std::vector<Fixture> boardFixtures() {
+  return {
+    {"empty", Board()},
+    // Fourteen rows of ragged stack, each with one gap, leaving a few rows
+    // above it for the piece to move through.
+    {"tall_stack", makeBoard({"#########.", "##.#######", "#####.####",
+                              ".#########", "#######.##", "###.######",
+                              "########.#", "#.########", "######.###",
+                              "####.#####", "##.####.##", "#####..###",
+                              "#.##...###", "...#....##"})},
+    // Full rows but for a single well, waiting for an I piece.
+    {"near_full", makeBoard({"#########.", "#########.", "#########.",
+                             "#########.", "####.####.", "###...##.."})},
+  };
+}
+
+// A board whose bottom four rows are full but for the last column, except
+// that the top 4 - Lines of them are also missing the first column, so a
+// vertical I piece dropped down the right wall clears exactly Lines rows.
+Board clearFixture(int Lines) {
+  Board Grid;
+  for (int i = 0; i < 4; ++i) {
+    int Row = Board::Rows - 1 - i;
+    for (int Col = i < Lines ? 0 : 1; Col < Board::Cols - 1; ++Col) {
+      Grid.setCell(Row, Col, Tetromino::T);
+    }
+  }
+  return Grid;
+}
+
+// Returns a seed whose first piece is Kind.
+uint64_t seedStartingWith(Tetromino::Kind Kind) {
+  uint64_t Seed = 0;
+  TetrisGame Game;
+  while (true) {
+    Game.reset(Seed, PieceGenerator::Uniform);
+    if (Game.getCurrent().getKind() == Kind) {
+      return Seed;
+    }
+    ++Seed;
+  }
+}
+
+// Every position of every piece in every rotation, fitting or not, as
+// currentPosIsValid() sees them while pieces move and rotate.
+struct Probe {
+  const Tetromino::Shape *Shape;
+  int X, Y;
+};
+
+std::vector<Probe> probes() {
+  std::vector<Probe> Result;
+  for (int Kind = 0; Kind < Tetromino::NumKinds; ++Kind) {
+    Tetromino Piece((Tetromino::Kind)Kind);
+    for (int R = 0; R < Piece.getNumRotations(); ++R, Piece.rotateRight()) {
+      for (int Y = 0; Y <= Board::Rows; ++Y) {
+        for (int X = -Board::WallBits; X <= 16 - 4 - Board::WallBits; ++X) {
+          Result.push_back({&Piece.getShape(), X, Y});
+        }
+      }
+    }
+  }
+  return Result;
+}
+
+void benchFits(const Fixture &F) {
+  std::vector<Probe> Probes = probes();
+  run("currentPosIsValid", F.Name, Probes.size(), [&] {
+    unsigned Fits = 0;
+    for (const Probe &P : Probes) {
+      Fits += F.Grid.fits(*P.Shape, P.X, P.Y);
+    }
+    keep(Fits);
+  });
+}
+
+void benchDownDestination(const Fixture &F) {
+  // The current piece in every rotation and column it can reach from the
+  // spawn position.
+  std::vector<TetrisGame> Games;
+  for (int Kind = 0; Kind < Tetromino::NumKinds; ++Kind) {
+    TetrisGame Game;
+    Game.reset(seedStartingWith((Tetromino::Kind)Kind),
+               PieceGenerator::Uniform, F.Grid);
+    for (int R = 0; R < Game.getCurrent().getNumRotations(); ++R) {
+      TetrisGame Column = Game;
+      while (true) {
+        Games.push_back(Column);
+        int X = Column.getCurrentPos().x;
+        Column.apply(Action::MoveRight);
+        if (Column.getCurrentPos().x == X) {
+          break;
+        }
+      }
+      Game.apply(Action::RotateRight);
+    }
+  }
+  // Fresh copies for every batch, so that the landing spot cached by the
+  // last batch is not simply read back.
+  std::vector<TetrisGame> Fresh = Games;
+  run("downDestination", F.Name, Games.size(),
+      [&] {
+        int Rows = 0;
+        for (const TetrisGame &Game : Games) {
+          Rows += Game.downDestination().y;
+        }
+        keep(Rows);
+      },
+      [&] { Games = Fresh; });
+}
+
+// Times hard drops of a vertical I piece that clear Lines rows, which is
+// downDestination() followed by onPieceDown().
+bool benchPieceDown(int Lines) {
+  TetrisGame Start;
+  Start.reset(seedStartingWith(Tetromino::I), PieceGenerator::Uniform,
+              clearFixture(Lines));
+  Start.apply(Action::RotateRight);
+  for (int i = 0; i < Board::Cols; ++i) {
+    Start.apply(Action::MoveRight);
+  }
+
+  TetrisGame Check = Start;
+  Check.apply(Action::HardDrop);
+  if (Check.getLines() != uint64_t(Lines)) {
+    std::cerr << "clear fixture for " << Lines << " lines cleared "
+              << Check.getLines() << '\n';
+    return false;
+  }
+
+  const int Batch = 256;
+  std::vector<TetrisGame> Games(Batch, Start);
+  std::string Fixture = "clears_" + std::to_string(Lines);
+  run("onPieceDown", Fixture, Batch,
+      [&] {
+        for (TetrisGame &Game : Games) {
+          Game.apply(Action::HardDrop);
+        }
+        keep(Games[0]);
+      },
+      [&] { std::fill(Games.begin(), Games.end(), Start); });
+  return true;
+}
+
+void benchRotate() {
+  std::vector<Tetromino> Pieces;
+  for (int Kind = 0; Kind < Tetromino::NumKinds; ++Kind) {
+    Pieces.push_back(Tetromino((Tetromino::Kind)Kind));
+  }
+  const int Turns = 64;
+  run("rotateLeft", "all_kinds", Turns * Pieces.size(), [&] {
+    for (int i = 0; i < Turns; ++i) {
+      for (Tetromino &Piece : Pieces) {
+        Piece.rotateLeft();
+      }
+      keep(Pieces[0]);
+    }
+  });
+  run("rotateRight", "all_kinds", Turns * Pieces.size(), [&] {
+    for (int i = 0; i < Turns; ++i) {
+      for (Tetromino &Piece : Pieces) {
+        Piece.rotateRight();
+      }
+      keep(Pieces[0]);
+    }
+  });
+}
+
+// The kernels that scale with the board on every size compiled in. Clears
+// and evaluation are counted per cell of the board, so that sizes can be
+// compared directly; fits() is counted per probe, as it only ever looks at
+// four rows.
+template <int NumRows, int NumCols> void benchBoardSize() {
+  typedef BasicBoard<NumRows, NumCols> SizedBoard;
+  const int Cells = NumRows * NumCols;
+  std::string Size = std::to_string(NumRows) + "x" + std::to_string(NumCols);
+
+  // The bottom half filled but for one gap per row, at columns from a fixed
+  // sequence, and the same with the bottom four rows full.
+  SizedBoard Stack;
+  uint64_t State = 1;
+  std::vector<int> Gaps;
+  for (int Row = NumRows / 2; Row < NumRows; ++Row) {
+    State = State * 6364136223846793005u + 1442695040888963407u;
+    Gaps.push_back((State >> 33) % NumCols);
+    for (int Col = 0; Col < NumCols; ++Col) {
+      if (Col != Gaps.back()) {
+        Stack.setCell(Row, Col, Tetromino::T);
+      }
+    }
+  }
+  SizedBoard Full = Stack;
+  for (int i = 0; i < 4; ++i) {
+    Full.setCell(NumRows - 1 - i, Gaps[Gaps.size() - 1 - i], Tetromino::T);
+  }
+
+  std::vector<Probe> Probes;
+  for (int Kind = 0; Kind < Tetromino::NumKinds; ++Kind) {
+    Tetromino Piece((Tetromino::Kind)Kind);
+    for (int R = 0; R < Piece.getNumRotations(); ++R, Piece.rotateRight()) {
+      for (int Y = 0; Y <= NumRows; ++Y) {
+        for (int X = -SizedBoard::WallBits; X < NumCols; ++X) {
+          Probes.push_back({&Piece.getShape(), X, Y});
+        }
+      }
+    }
+  }
+  run("fits", "half_stack_" + Size, Probes.size(), [&] {
+    unsigned Fits = 0;
+    for (const Probe &P : Probes) {
+      Fits += Stack.fits(*P.Shape, P.X, P.Y);
+    }
+    keep(Fits);
+  });
+
+  const int Batch = 64;
+  std::vector<SizedBoard> Boards(Batch, Full);
+  run("clearFullRows_per_cell", "four_rows_" + Size, Batch * Cells,
+      [&] {
+        unsigned Cleared = 0;
+        for (SizedBoard &Grid : Boards) {
+          Cleared += Grid.clearFullRows(NumRows - 4, NumRows - 1);
+        }
+        keep(Cleared);
+      },
+      [&] { std::fill(Boards.begin(), Boards.end(), Full); });
+
+  BasicAutoplayer<NumRows, NumCols> AI;
+  run("evaluate_per_cell", "half_stack_" + Size, Batch * Cells, [&] {
+    double Score = 0;
+    for (int i = 0; i < Batch; ++i) {
+      Score += AI.evaluate(Stack, 0);
+    }
+    keep(Score);
+  });
+}
+
+// Times every kernel this CPU supports, and the reference, on boards like
+// the ones placement search scores. tetris_tests checks that they agree.
+void benchBoardFeatures() {
+  std::vector<Board> Boards = candidateBoards();
+  BoardFeatureBatch Batch;
+  for (const Board &Grid : Boards) {
+    Batch.add(Grid);
+  }
+
+  struct {
+    const char *Name;
+    BoardFeatureBatch::Kernel Kernel;
+  } Kernels[] = {{"scalar", BoardFeatureBatch::Scalar},
+                 {"avx2", BoardFeatureBatch::Avx2}};
+  for (const auto &K : Kernels) {
+    if (K.Kernel > BoardFeatureBatch::bestKernel()) {
+      continue;
+    }
+    run("boardFeatures", K.Name, Boards.size(),
+        [&] {
+          Batch.evaluate(K.Kernel);
+          keep(Batch);
+        });
+  }
+  run("boardFeatures", "reference", Boards.size(), [&] {
+    unsigned Holes = 0;
+    for (const Board &Grid : Boards) {
+      Holes += referenceFeatures(Grid).Holes;
+    }
+    keep(Holes);
+  });
+}
+
+// Times choosing a placement with the lookahead through holds, from a game
+// that has been going for a while and has something held, with and
+// without a fresh transposition table for each choice.
+void benchLookahead() {
+  Autoplayer::Options Opts;
+  Opts.Lookahead = false;
+  Autoplayer Warmup(Opts);
+  TetrisGame Game;
+  Game.reset(0, PieceGenerator::Uniform);
+  Game.apply(Action::Hold);
+  for (int i = 0; i < 40; ++i) {
+    Warmup.playPiece(Game);
+  }
+
+  Opts.Lookahead = true;
+  Opts.LookaheadHold = true;
+  Autoplayer AI(Opts);
+  run("choose", "hold_lookahead", 1, [&] { keep(AI.choose(Game)); });
+
+  std::unique_ptr<TranspositionTable> Table;
+  run("choose", "hold_lookahead_table", 1,
+      [&] {
+        Opts.Table = Table.get();
+        keep(Autoplayer(Opts).choose(Game));
+      },
+      [&] { Table.reset(new TranspositionTable(16)); });
+}
+
+// Times the simulation side of the game screen's frame loop, as its
+// simulation thread runs it, with the AI playing: a step a millisecond, an
+// input from the AI each step, a snapshot published for every frame, and
+// a new game whenever one ends, which the AI's games are cut short to do
+// every GameTicks. tetris_tests checks that such frames do not allocate.
+void benchFrame() {
+  const uint64_t FrameTicks = TetrisGame::TicksPerSecond / 60;
+  const uint64_t GameTicks = 15 * TetrisGame::TicksPerSecond;
+  Autoplayer AI;
+  TetrisGame Game;
+  Game.reset(1, PieceGenerator::Uniform);
+  SimClock Sim(Game);
+  TripleBuffer<TetrisGame> Snapshots;
+  uint64_t Seed = 1;
+  uint64_t Now = 0;
+
+  run("frame", "simulation_autoplayed", 1, [&] {
+    for (uint64_t End = Now + FrameTicks; Now < End;
+         Now += SimClock::StepTicks) {
+      if (Game.isGameOver() || Now >= GameTicks) {
+        Game.reset(++Seed, PieceGenerator::Uniform);
+        Sim.reset();
+        Now = 0;
+        break;
+      }
+      Sim.input(Now, AI.nextAction(Game));
+      Sim.advanceTo(Now, [&](Action A) { Game.apply(A); });
+    }
+    Snapshots.back() = Game;
+    Snapshots.publish();
+    keep(Snapshots.read());
+  });
+}
+
+// Times saving and restoring a snapshot of a game that has been going for
+// a while. tetris_tests checks that restored games play on unchanged.
+void benchSnapshot() {
+  Autoplayer::Options Opts;
+  Opts.Lookahead = false;
+  Autoplayer AI(Opts);
+  TetrisGame Game;
+  Game.reset(3, PieceGenerator::SevenBag);
+  Game.apply(Action::Hold);
+  for (int i = 0; i < 30; ++i) {
+    AI.playPiece(Game);
+  }
+
+  TetrisGame::Snapshot Snap;
+  TetrisGame Copy;
+  Game.save(Snap);
+  const int Batch = 64;
+  run("snapshot", "save", Batch, [&] {
+    for (int i = 0; i < Batch; ++i) {
+      Game.save(Snap);
+      keep(Snap);
+    }
+  });
+  run("snapshot", "restore", Batch, [&] {
+    for (int i = 0; i < Batch; ++i) {
+      keep(Copy.restore(Snap));
+    }
+  });
+}
+
+// Times encoding a 640x480 frame of flat blocks, like a captured game.
+void benchEncodePng() {
+  const unsigned Width = 640, Height = 480;
+  std::vector<uint8_t> Pixels(Width * Height * 4);
+  for (unsigned Y = 0; Y < Height; ++Y) {
+    for (unsigned X = 0; X < Width; ++X) {
+      uint8_t *P = &Pixels[(Y * Width + X) * 4];
+      unsigned Cell = (Y / 24) * 31 + X / 24;
+      P[0] = Cell * 37;
+      P[1] = Cell * 11;
+      P[2] = X % 24 && Y % 24 ? Cell * 5 : 0;
+      P[3] = 255;
+    }
+  }
+  std::vector<uint8_t> Out;
+  run("encodePng", "blocks_640x480", 1, [&] {
+    Out.clear();
+    encodePng(Pixels.data(), Width, Height, Out);
+    keep(Out);
+  });
+}
+
+void benchHighScores() {
+  // A million scores from all over the range, as a table aggregated from
+  // many machines would hold.
+  HighScoreTable Table;
+  uint64_t State = 1;
+  auto NextScore = [&] {
+    State = State * 6364136223846793005u + 1442695040888963407u;
+    return (State >> 33) % 1000000;
+  };
+  for (int i = 0; i < 1000000; ++i) {
+    Table.addScore("PLAYER" + std::to_string(i % 1000), NextScore());
+  }
+
+  // Scores keep rising so that each lands at the top of the best few,
+  // the longest insertion there.
+  uint64_t Score = 1000000;
+  const int Batch = 64;
+  run("addScore", "million_scores", Batch, [&] {
+    for (int i = 0; i < Batch; ++i) {
+      keep(Table.addScore("PLAYER", ++Score));
+    }
+  });
+  run("getRank", "million_scores", Batch, [&] {
+    uint64_t Ranks = 0;
+    for (int i = 0; i < Batch; ++i) {
+      Ranks += Table.getRank(NextScore());
+    }
+    keep(Ranks);
+  });
+}
+
+void printJson() {
+  std::cout << "{\n  \"min_time_s\": " << MinTime
+            << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < Results.size(); ++i) {
+    const Result &R = Results[i];
+    std::cout << (i ? "," : "") << "\n    {\"name\": \"" << R.Name
+              << "\", \"fixture\": \"" << R.Fixture
+              << "\", \"ns_per_op\": " << R.NsPerOp
+              << ", \"ops\": " << R.Ops << "}";
+  }
+  std::cout << "\n  ]\n}\n";
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string Arg = argv[i];
+    if (Arg == "--min-time" && i + 1 < argc) {
+      MinTime = std::strtod(argv[++i], nullptr);
+    } else if (Arg == "--filter" && i + 1 < argc) {
+      Filter = argv[++i];
+    } else {
+      std::cerr << "usage: tetris_bench [--min-time SECONDS] "
+                   "[--filter SUBSTRING]\n";
+      return 1;
+    }
+  }
+
+  for (const Fixture &F : boardFixtures()) {
+    benchFits(F);
+    benchDownDestination(F);
+  }
+  for (int Lines = 0; Lines <= 4; ++Lines) {
+    if (!benchPieceDown(Lines)) {
+      return 1;
+    }
+  }
+  benchRotate();
+  benchBoardFeatures();
+#define TETRIS_BENCH_BOARD_SIZE(Rows, Cols) benchBoardSize<Rows, Cols>();
+  TETRIS_BOARD_SIZES(TETRIS_BENCH_BOARD_SIZE)
+#undef TETRIS_BENCH_BOARD_SIZE
+  benchLookahead();
+  benchFrame();
+  benchSnapshot();
+  benchEncodePng();
+  benchHighScores();
+
+  printJson();
+  return 0;
+}
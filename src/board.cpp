@@ -0,0 +1,167 @@
+#include "board.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+bool isBoardSize(int Rows, int Cols) {
+#define TETRIS_IS_BOARD_SIZE(R, C)                                             \
+  if (Rows == R && Cols == C) {                                                \
+    return true;                                                               \
+  }
+  TETRIS_BOARD_SIZES(TETRIS_IS_BOARD_SIZE)
+#undef TETRIS_IS_BOARD_SIZE
+  return false;
+}
+
+template <int NumRows, int NumCols>
+void BasicBoard<NumRows, NumCols>::clear() {
+  std::fill(Masks, Masks + Rows, EmptyRow);
+  std::fill(Masks + Rows, std::end(Masks), FullRow);
+  std::fill(std::begin(Cells), std::end(Cells), Tetromino::NumKinds);
+  updateTops();
+}
+
+template <int NumRows, int NumCols>
+void BasicBoard<NumRows, NumCols>::updateTops() {
+  std::fill(std::begin(Tops), std::end(Tops), 0);
+  std::fill(Tops + WallBits, Tops + WallBits + Cols, Rows);
+  uint64_t Unseen = ~uint64_t(0) >> (64 - Cols);
+  for (int Row = 0; Row < Rows && Unseen; ++Row) {
+    uint64_t Found = getRow(Row) & Unseen;
+    Unseen &= ~Found;
+    for (; Found; Found &= Found - 1) {
+      Tops[WallBits + __builtin_ctzll(Found)] = Row;
+    }
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicBoard<NumRows, NumCols>::place(const Tetromino &Piece, int X, int Y) {
+  const Tetromino::Shape &Shape = Piece.getShape();
+  assert(fits(Shape, X, Y));
+  for (int i = Shape.MinY; i <= Shape.MaxY; ++i) {
+    Masks[Y + i] |= RowMask(Shape.Rows[i]) << (X + WallBits);
+  }
+  for (int i = 0; i < 4; ++i) {
+    int Row = Y + Shape.CellY[i];
+    int Col = X + Shape.CellX[i];
+    Cells[Row * Cols + Col] = Piece.getKind();
+    Tops[WallBits + Col] = std::min<int>(Tops[WallBits + Col], Row);
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicBoard<NumRows, NumCols>::setCell(int Row, int Col,
+                                           Tetromino::Kind Kind) {
+  assert(0 <= Row && Row < Rows && 0 <= Col && Col < Cols);
+  RowMask Bit = RowMask(1) << (Col + WallBits);
+  Cells[Row * Cols + Col] = Kind;
+  if (Kind == Tetromino::NumKinds) {
+    Masks[Row] &= ~Bit;
+    if (Tops[WallBits + Col] == Row) {
+      updateTops();
+    }
+  } else {
+    Masks[Row] |= Bit;
+    Tops[WallBits + Col] = std::min<int>(Tops[WallBits + Col], Row);
+  }
+}
+
+template <int NumRows, int NumCols>
+unsigned BasicBoard<NumRows, NumCols>::clearFullRows(int First, int Last) {
+  assert(0 <= First && First <= Last && Last < Rows);
+  while (Last >= First && Masks[Last] != FullRow) {
+    --Last;
+  }
+  if (Last < First) {
+    return 0;
+  }
+
+  // One pass from the lowest full row up: each surviving row in the range
+  // moves straight to its final place, then everything above the range
+  // moves down in one block.
+  int Dst = Last;
+  for (int Src = Last - 1; Src >= First; --Src) {
+    if (Masks[Src] == FullRow) {
+      continue;
+    }
+    Masks[Dst] = Masks[Src];
+    std::memcpy(Cells + Dst * Cols, Cells + Src * Cols, sizeof(*Cells) * Cols);
+    --Dst;
+  }
+  unsigned Cleared = Dst - First + 1;
+  std::copy_backward(Masks, Masks + First, Masks + Dst + 1);
+  std::copy_backward(Cells, Cells + First * Cols, Cells + (Dst + 1) * Cols);
+  std::fill(Masks, Masks + Cleared, EmptyRow);
+  std::fill(Cells, Cells + Cleared * Cols, Tetromino::NumKinds);
+  updateTops();
+  return Cleared;
+}
+
+template <int NumRows, int NumCols>
+bool BasicBoard<NumRows, NumCols>::addGarbage(int Count, int Hole) {
+  assert(0 <= Count && Count <= Rows && 0 <= Hole && Hole < Cols);
+  bool Overflow = false;
+  for (int Row = 0; Row < Count; ++Row) {
+    Overflow |= Masks[Row] != EmptyRow;
+  }
+  std::copy(Masks + Count, Masks + Rows, Masks);
+  std::copy(Cells + Count * Cols, Cells + Rows * Cols, Cells);
+
+  RowMask Filled = FullRow & ~(RowMask(1) << (Hole + WallBits));
+  for (int Row = Rows - Count; Row < Rows; ++Row) {
+    Masks[Row] = Filled;
+    std::fill(Cells + Row * Cols, Cells + (Row + 1) * Cols, Garbage);
+    Cells[Row * Cols + Hole] = Tetromino::NumKinds;
+  }
+  updateTops();
+  return !Overflow;
+}
+
+template <int NumRows, int NumCols>
+void BasicBoard<NumRows, NumCols>::pack(uint8_t *Out) const {
+  const int N = Rows * Cols;
+  for (int i = 0; i + 1 < N; i += 2) {
+    *Out++ = Cells[i] | Cells[i + 1] << 4;
+  }
+  if (N % 2) {
+    *Out = Cells[N - 1];
+  }
+}
+
+template <int NumRows, int NumCols>
+bool BasicBoard<NumRows, NumCols>::unpack(const uint8_t *In) {
+  // Checked as a running maximum rather than cell by cell, which the
+  // compiler turns into a few vector instructions.
+  uint8_t Highest = 0;
+  for (int i = 0; i < PackedBytes; ++i) {
+    Highest = std::max<uint8_t>(Highest, In[i] & 0xF);
+    Highest = std::max<uint8_t>(Highest, In[i] >> 4);
+  }
+  if (Highest > Garbage) {
+    return false;
+  }
+  const int N = Rows * Cols;
+  for (int i = 0; i < N / 2; ++i) {
+    Cells[2 * i] = Tetromino::Kind(In[i] & 0xF);
+    Cells[2 * i + 1] = Tetromino::Kind(In[i] >> 4);
+  }
+  if (N % 2) {
+    Cells[N - 1] = Tetromino::Kind(In[N / 2] & 0xF);
+  }
+  for (int Row = 0; Row < Rows; ++Row) {
+    const Tetromino::Kind *Cell = Cells + Row * Cols;
+    uint64_t Filled = 0;
+    for (int Col = 0; Col < Cols; ++Col) {
+      Filled |= uint64_t(Cell[Col] != Tetromino::NumKinds) << Col;
+    }
+    Masks[Row] = EmptyRow | RowMask(Filled) << WallBits;
+  }
+  updateTops();
+  return true;
+}
+
+#define TETRIS_BOARD(Rows, Cols) template class BasicBoard<Rows, Cols>;
+TETRIS_BOARD_SIZES(TETRIS_BOARD)
+#undef TETRIS_BOARD
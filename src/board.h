@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "tetromino.h"
+
+// The board sizes that are compiled in, as rows x columns. Code that has
+// to pick one at run time expands this with a macro taking both.
+#define TETRIS_BOARD_SIZES(X) X(20, 10) X(40, 10) X(24, 32) X(64, 64)
+
+// Whether Rows x Cols is one of TETRIS_BOARD_SIZES.
+bool isBoardSize(int Rows, int Cols);
+
+// The narrowest unsigned type at least Bits wide. Past 64 bits this is a
+// pair of machine words, which the compiler operates on together.
+template <int Bits>
+using BitsFor = typename std::conditional<
+    Bits <= 16, uint16_t,
+    typename std::conditional<
+        Bits <= 32, uint32_t,
+        typename std::conditional<Bits <= 64, uint64_t,
+                                  unsigned __int128>::type>::type>::type;
+
+// Occupancy of the playfield as one bitmask per row, so that collision,
+// locking and full-row detection are plain mask operations. Column J of the
+// playfield is bit J + WallBits of its row; every other bit is permanently
+// set, and a few solid rows sit below the last one, so that walls and floor
+// collide like any filled cell. The kind of piece that filled each cell is
+// kept on the side for rendering.
+//
+// Each size gets the narrowest mask that holds a row and its walls, so the
+// standard board tests a piece against four rows in one 64-bit word, and
+// wider boards with a word or two per row.
+template <int NumRows, int NumCols> class BasicBoard {
+public:
+  static_assert(NumRows >= 4 && NumRows <= 127 && NumCols >= 4 &&
+                    NumCols <= 64,
+                "rows must fit an int8_t position, and columns a uint64_t");
+
+  static const int Rows = NumRows;
+  static const int Cols = NumCols;
+  static const int WallBits = 3;
+  typedef BitsFor<Cols + 2 * WallBits> RowMask;
+  // The playfield columns of a row, as getRow() returns them.
+  typedef BitsFor<Cols> ColumnMask;
+  static const int MaskBits = 8 * sizeof(RowMask);
+  static const RowMask FullRow = RowMask(~RowMask(0));
+  static const RowMask EmptyRow =
+    FullRow & ~((RowMask(ColumnMask(~ColumnMask(0)) >>
+                         (8 * sizeof(ColumnMask) - Cols)))
+                << WallBits);
+  // The kind of the cells in garbage rows, which no piece left behind.
+  static const Tetromino::Kind Garbage =
+    Tetromino::Kind(Tetromino::NumKinds + 1);
+
+  BasicBoard() { clear(); }
+
+  void clear();
+  inline bool fits(const Tetromino::Shape &Shape, int X, int Y) const;
+  // Returns the lowest Y that a shape fitting at (X, Y) can fall to.
+  inline int dropY(const Tetromino::Shape &Shape, int X, int Y) const;
+  void place(const Tetromino &Piece, int X, int Y);
+  // Fills or, with Tetromino::NumKinds, empties a single cell.
+  void setCell(int Row, int Col, Tetromino::Kind Kind);
+  // Removes the full rows among First..Last, moving everything above them
+  // down, and returns how many there were. Rows outside the range must not
+  // be full; after place(), only the rows the piece covers can be.
+  unsigned clearFullRows(int First, int Last);
+  unsigned clearFullRows() { return clearFullRows(0, Rows - 1); }
+  // Pushes everything up by Count rows and fills the bottom ones with
+  // garbage, except for column Hole. Returns false if filled cells were
+  // pushed off the top.
+  bool addGarbage(int Count, int Hole);
+
+  // The playfield columns of a row, with column J at bit J.
+  ColumnMask getRow(int Row) const {
+    return ColumnMask((Masks[Row] & ~EmptyRow) >> WallBits);
+  }
+
+  // The highest filled row of a column, or Rows if it is empty.
+  int getColumnTop(int Col) const { return Tops[WallBits + Col]; }
+
+  // Returns Tetromino::NumKinds for empty cells.
+  Tetromino::Kind getCell(int Row, int Col) const {
+    return Cells[Row * Cols + Col];
+  }
+
+  // Every cell's kind, two to a byte with the first in the low nibble, from
+  // the top row down: PackedBytes bytes that unpack() restores the board
+  // from.
+  static const int PackedBytes = (Rows * Cols + 1) / 2;
+  void pack(uint8_t *Out) const;
+  // Returns false, changing nothing, if a cell holds no kind a board can.
+  bool unpack(const uint8_t *In);
+
+private:
+  RowMask Masks[Rows + 4];
+  Tetromino::Kind Cells[Rows * Cols];
+  // The skyline, kept up to date by every change to the board, with the
+  // walls as columns filled to the top on either side.
+  uint8_t Tops[MaskBits];
+
+  void updateTops();
+};
+
+template <int NumRows, int NumCols>
+const int BasicBoard<NumRows, NumCols>::Rows;
+template <int NumRows, int NumCols>
+const int BasicBoard<NumRows, NumCols>::Cols;
+template <int NumRows, int NumCols>
+const int BasicBoard<NumRows, NumCols>::WallBits;
+template <int NumRows, int NumCols>
+const int BasicBoard<NumRows, NumCols>::MaskBits;
+template <int NumRows, int NumCols>
+const typename BasicBoard<NumRows, NumCols>::RowMask
+    BasicBoard<NumRows, NumCols>::FullRow;
+template <int NumRows, int NumCols>
+const typename BasicBoard<NumRows, NumCols>::RowMask
+    BasicBoard<NumRows, NumCols>::EmptyRow;
+template <int NumRows, int NumCols>
+const Tetromino::Kind BasicBoard<NumRows, NumCols>::Garbage;
+template <int NumRows, int NumCols>
+const int BasicBoard<NumRows, NumCols>::PackedBytes;
+
+template <int NumRows, int NumCols>
+bool BasicBoard<NumRows, NumCols>::fits(const Tetromino::Shape &Shape, int X,
+                                        int Y) const {
+  int Shift = X + WallBits;
+  if (Shift < 0 || Shift > MaskBits - 4) {
+    return false;
+  }
+  assert(0 <= Y && Y <= Rows);
+
+  if (sizeof(RowMask) == sizeof(Shape.Rows[0])) {
+    // All four rows are tested at once. Each row of the piece is four bits
+    // wide and shifted by at most 12, so nothing crosses into the next row.
+    uint64_t PieceRows, BoardRows;
+    std::memcpy(&PieceRows, Shape.Rows, sizeof(PieceRows));
+    std::memcpy(&BoardRows, &Masks[Y], sizeof(BoardRows));
+    return (BoardRows & (PieceRows << Shift)) == 0;
+  }
+
+  // Wider rows are tested one at a time, without branching on any, by
+  // shifting the four columns under the piece down to meet it.
+  unsigned Overlap = 0;
+  for (int i = 0; i < 4; ++i) {
+    Overlap |= unsigned(Masks[Y + i] >> Shift) & Shape.Rows[i];
+  }
+  return Overlap == 0;
+}
+
+template <int NumRows, int NumCols>
+int BasicBoard<NumRows, NumCols>::dropY(const Tetromino::Shape &Shape, int X,
+                                        int Y) const {
+  assert(fits(Shape, X, Y));
+  // When every column of the piece is above the stack in that column, it
+  // falls until its bottom meets the skyline. Otherwise some gap comes out
+  // negative.
+  const uint8_t *Columns = Tops + WallBits + X;
+  int Distance = Rows;
+  for (int i = 0; i < 4; ++i) {
+    int Gap = Columns[i] - 1 - (Y + Shape.Bottom[i]);
+    Distance = Gap < Distance ? Gap : Distance;
+  }
+  if (Distance >= 0) {
+    return Y + Distance;
+  }
+
+  // Otherwise the piece is tucked under an overhang, and has to be walked
+  // down row by row.
+  while (fits(Shape, X, Y + 1)) {
+    ++Y;
+  }
+  return Y;
+}
+
+typedef BasicBoard<20, 10> Board;
+
+#define TETRIS_EXTERN_BOARD(Rows, Cols)                                        \
+  extern template class BasicBoard<Rows, Cols>;
+TETRIS_BOARD_SIZES(TETRIS_EXTERN_BOARD)
+#undef TETRIS_EXTERN_BOARD
@@ -0,0 +1,302 @@
+#include "board_features.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TETRIS_AVX2_KERNEL 1
+#endif
+
+namespace {
+
+const int Rows = Board::Rows;
+const int Cols = Board::Cols;
+static_assert(Cols + 2 <= 16, "a row and its walls must fit in a lane");
+const uint16_t ColumnBits = (1u << Cols) - 1;
+// A row widened by one bit on either side for the walls, as bits 0 and
+// Cols + 1.
+const uint16_t Walls = 1u | 1u << (Cols + 1);
+// Each bit K of a widened row compared with bit K + 1 covers every pair of
+// neighbouring cells, walls included.
+const uint16_t Boundaries = (1u << (Cols + 1)) - 1;
+
+// The reference works on cells; everything outside the board but above it
+// is filled.
+bool isFilled(const Board &Grid, int Row, int Col) {
+  if (Col < 0 || Col >= Cols || Row >= Rows) {
+    return true;
+  }
+  return Row >= 0 && Grid.getCell(Row, Col) != Tetromino::NumKinds;
+}
+
+// Sixteen-bit lanes of a 64-bit word, so that the fallback handles four
+// boards at a time with plain integer operations. Shifting a whole word
+// moves a few bits across lanes, but only into bits that are masked off.
+uint64_t lanes(uint16_t Value) { return Value * 0x0001000100010001u; }
+
+uint64_t load4(const uint16_t *Lanes) {
+  uint64_t Word;
+  std::memcpy(&Word, Lanes, sizeof(Word));
+  return Word;
+}
+
+void store4(uint16_t *Lanes, uint64_t Word) {
+  std::memcpy(Lanes, &Word, sizeof(Word));
+}
+
+// Bits set in each lane.
+uint64_t popcount4(uint64_t Word) {
+  Word -= Word >> 1 & 0x5555555555555555u;
+  Word = (Word & 0x3333333333333333u) + (Word >> 2 & 0x3333333333333333u);
+  Word = (Word + (Word >> 4)) & 0x0F0F0F0F0F0F0F0Fu;
+  return (Word + (Word >> 8)) & 0x00FF00FF00FF00FFu;
+}
+
+// Heights are counted as the rows in which each column is already covered,
+// which vectorizes where finding the top of each column would not.
+void scalarBlock(const BoardFeatureBatch::RowBlock &In,
+                 BoardFeatureBatch::FeatureBlock &Out) {
+  const uint64_t One = lanes(1), ColumnMask = lanes(ColumnBits);
+  const uint64_t WallMask = lanes(Walls), BoundaryMask = lanes(Boundaries);
+  const uint64_t WellMask = lanes(ColumnBits << 1);
+  for (int Lane = 0; Lane < BoardFeatureBatch::Lanes; Lane += 4) {
+    uint64_t Covered = 0, Above = 0;
+    uint64_t Holes = 0, RowTransitions = 0, ColumnTransitions = 0, Wells = 0;
+    uint64_t Heights[Cols] = {};
+    for (int Row = 0; Row < Rows; ++Row) {
+      uint64_t Cells = load4(&In.Rows[Row][Lane]);
+      uint64_t Wide = Cells << 1 | WallMask;
+      RowTransitions += popcount4((Wide ^ Wide >> 1) & BoundaryMask);
+      ColumnTransitions += popcount4(Above ^ Cells);
+      Wells += popcount4(~Wide & Wide << 1 & Wide >> 1 & WellMask);
+      Holes += popcount4(Covered & ~Cells);
+      Covered |= Cells;
+      Above = Cells;
+      for (int Col = 0; Col < Cols; ++Col) {
+        Heights[Col] += Covered >> Col & One;
+      }
+    }
+    ColumnTransitions += popcount4(Above ^ ColumnMask);
+
+    for (int Col = 0; Col < Cols; ++Col) {
+      store4(&Out.Heights[Col][Lane], Heights[Col]);
+    }
+    for (int i = Lane; i < Lane + 4; ++i) {
+      int Bumpiness = 0;
+      for (int Col = 1; Col < Cols; ++Col) {
+        Bumpiness += std::abs(Out.Heights[Col][i] - Out.Heights[Col - 1][i]);
+      }
+      Out.Bumpiness[i] = Bumpiness;
+    }
+    store4(&Out.Holes[Lane], Holes);
+    store4(&Out.RowTransitions[Lane], RowTransitions);
+    store4(&Out.ColumnTransitions[Lane], ColumnTransitions);
+    store4(&Out.Wells[Lane], Wells);
+  }
+}
+
+#ifdef TETRIS_AVX2_KERNEL
+
+static_assert(BoardFeatureBatch::Lanes * sizeof(uint16_t) == sizeof(__m256i),
+              "a block row is one AVX2 vector");
+
+__attribute__((target("avx2"))) inline __m256i load(const uint16_t *Lanes) {
+  return _mm256_loadu_si256((const __m256i *)Lanes);
+}
+
+__attribute__((target("avx2"))) inline void store(uint16_t *Lanes,
+                                                  __m256i V) {
+  _mm256_storeu_si256((__m256i *)Lanes, V);
+}
+
+// Bits set in each 16-bit lane, looked up a nibble at a time.
+__attribute__((target("avx2"))) inline __m256i popcount16(__m256i V) {
+  const __m256i Nibbles =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                       1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i Low = _mm256_set1_epi8(0x0F);
+  __m256i Bytes = _mm256_add_epi8(
+      _mm256_shuffle_epi8(Nibbles, _mm256_and_si256(V, Low)),
+      _mm256_shuffle_epi8(Nibbles,
+                          _mm256_and_si256(_mm256_srli_epi16(V, 4), Low)));
+  return _mm256_add_epi16(_mm256_and_si256(Bytes, _mm256_set1_epi16(0xFF)),
+                          _mm256_srli_epi16(Bytes, 8));
+}
+
+// The same as scalarBlock(), for all sixteen boards at once.
+__attribute__((target("avx2"))) void
+avx2Block(const BoardFeatureBatch::RowBlock &In,
+          BoardFeatureBatch::FeatureBlock &Out) {
+  const __m256i One = _mm256_set1_epi16(1);
+  const __m256i ColumnMask = _mm256_set1_epi16(ColumnBits);
+  const __m256i WallMask = _mm256_set1_epi16(Walls);
+  const __m256i BoundaryMask = _mm256_set1_epi16(Boundaries);
+  const __m256i WellMask = _mm256_set1_epi16(ColumnBits << 1);
+
+  __m256i Covered = _mm256_setzero_si256(), Above = Covered;
+  __m256i Holes = Covered, RowTransitions = Covered;
+  __m256i ColumnTransitions = Covered, Wells = Covered;
+  __m256i Heights[Cols];
+  for (__m256i &Height : Heights) {
+    Height = _mm256_setzero_si256();
+  }
+
+  for (int Row = 0; Row < Rows; ++Row) {
+    __m256i Cells = load(In.Rows[Row]);
+    __m256i Wide = _mm256_or_si256(_mm256_slli_epi16(Cells, 1), WallMask);
+    __m256i Left = _mm256_srli_epi16(Wide, 1);
+    __m256i Right = _mm256_slli_epi16(Wide, 1);
+    RowTransitions = _mm256_add_epi16(
+        RowTransitions,
+        popcount16(_mm256_and_si256(_mm256_xor_si256(Wide, Left),
+                                    BoundaryMask)));
+    ColumnTransitions = _mm256_add_epi16(
+        ColumnTransitions, popcount16(_mm256_xor_si256(Above, Cells)));
+    Wells = _mm256_add_epi16(
+        Wells, popcount16(_mm256_andnot_si256(
+                   Wide, _mm256_and_si256(_mm256_and_si256(Left, Right),
+                                          WellMask))));
+    Holes = _mm256_add_epi16(Holes,
+                             popcount16(_mm256_andnot_si256(Cells, Covered)));
+    Covered = _mm256_or_si256(Covered, Cells);
+    Above = Cells;
+    for (int Col = 0; Col < Cols; ++Col) {
+      __m256i Bit = _mm256_srl_epi16(Covered, _mm_cvtsi32_si128(Col));
+      Heights[Col] =
+          _mm256_add_epi16(Heights[Col], _mm256_and_si256(Bit, One));
+    }
+  }
+  ColumnTransitions = _mm256_add_epi16(
+      ColumnTransitions, popcount16(_mm256_xor_si256(Above, ColumnMask)));
+
+  __m256i Bumpiness = _mm256_setzero_si256();
+  for (int Col = 0; Col < Cols; ++Col) {
+    store(Out.Heights[Col], Heights[Col]);
+    if (Col > 0) {
+      Bumpiness = _mm256_add_epi16(
+          Bumpiness,
+          _mm256_abs_epi16(_mm256_sub_epi16(Heights[Col], Heights[Col - 1])));
+    }
+  }
+  store(Out.Holes, Holes);
+  store(Out.RowTransitions, RowTransitions);
+  store(Out.ColumnTransitions, ColumnTransitions);
+  store(Out.Bumpiness, Bumpiness);
+  store(Out.Wells, Wells);
+}
+
+#endif // TETRIS_AVX2_KERNEL
+
+} // end anonymous namespace
+
+bool BoardFeatures::operator==(const BoardFeatures &Other) const {
+  return std::memcmp(Heights, Other.Heights, sizeof(Heights)) == 0 &&
+         Holes == Other.Holes && RowTransitions == Other.RowTransitions &&
+         ColumnTransitions == Other.ColumnTransitions &&
+         Bumpiness == Other.Bumpiness && Wells == Other.Wells;
+}
+
+BoardFeatures referenceFeatures(const Board &Grid) {
+  BoardFeatures Result = {};
+  for (int Col = 0; Col < Cols; ++Col) {
+    bool Covered = false;
+    for (int Row = 0; Row < Rows; ++Row) {
+      bool Filled = isFilled(Grid, Row, Col);
+      if (Filled && !Covered) {
+        Result.Heights[Col] = Rows - Row;
+      }
+      Result.Holes += Covered && !Filled;
+      Covered |= Filled;
+    }
+    if (Col > 0) {
+      Result.Bumpiness +=
+          std::abs(Result.Heights[Col] - Result.Heights[Col - 1]);
+    }
+    for (int Row = -1; Row < Rows; ++Row) {
+      Result.ColumnTransitions +=
+          isFilled(Grid, Row, Col) != isFilled(Grid, Row + 1, Col);
+    }
+  }
+  for (int Row = 0; Row < Rows; ++Row) {
+    for (int Col = -1; Col < Cols; ++Col) {
+      Result.RowTransitions +=
+          isFilled(Grid, Row, Col) != isFilled(Grid, Row, Col + 1);
+    }
+    for (int Col = 0; Col < Cols; ++Col) {
+      Result.Wells += !isFilled(Grid, Row, Col) &&
+                      isFilled(Grid, Row, Col - 1) &&
+                      isFilled(Grid, Row, Col + 1);
+    }
+  }
+  return Result;
+}
+
+const int BoardFeatureBatch::Lanes;
+
+BoardFeatureBatch::Kernel BoardFeatureBatch::bestKernel() {
+#ifdef TETRIS_AVX2_KERNEL
+  static const bool HasAvx2 = __builtin_cpu_supports("avx2");
+  if (HasAvx2) {
+    return Avx2;
+  }
+#endif
+  return Scalar;
+}
+
+void BoardFeatureBatch::reserve(size_t Boards) {
+  size_t Blocks = (Boards + Lanes - 1) / Lanes;
+  In.reserve(Blocks);
+  Out.reserve(Blocks);
+}
+
+void BoardFeatureBatch::add(const Board &Grid) {
+  size_t Lane = Count % Lanes;
+  if (Count / Lanes == In.size()) {
+    // Unused lanes hold empty boards, which are as cheap as any.
+    In.emplace_back();
+    std::memset(&In.back(), 0, sizeof(RowBlock));
+  } else if (Lane == 0) {
+    std::memset(&In[Count / Lanes], 0, sizeof(RowBlock));
+  }
+  RowBlock &Block = In[Count / Lanes];
+  for (int Row = 0; Row < Rows; ++Row) {
+    Block.Rows[Row][Lane] = Grid.getRow(Row);
+  }
+  ++Count;
+}
+
+void BoardFeatureBatch::evaluate(Kernel K) {
+  size_t Blocks = (Count + Lanes - 1) / Lanes;
+  if (Out.size() < Blocks) {
+    Out.resize(Blocks);
+  }
+#ifdef TETRIS_AVX2_KERNEL
+  if (K == Avx2 && bestKernel() == Avx2) {
+    for (size_t i = 0; i < Blocks; ++i) {
+      avx2Block(In[i], Out[i]);
+    }
+    return;
+  }
+#else
+  (void)K;
+#endif
+  for (size_t i = 0; i < Blocks; ++i) {
+    scalarBlock(In[i], Out[i]);
+  }
+}
+
+BoardFeatures BoardFeatureBatch::get(size_t Index) const {
+  const FeatureBlock &Block = Out[Index / Lanes];
+  size_t Lane = Index % Lanes;
+  BoardFeatures Result;
+  for (int Col = 0; Col < Cols; ++Col) {
+    Result.Heights[Col] = Block.Heights[Col][Lane];
+  }
+  Result.Holes = Block.Holes[Lane];
+  Result.RowTransitions = Block.RowTransitions[Lane];
+  Result.ColumnTransitions = Block.ColumnTransitions[Lane];
+  Result.Bumpiness = Block.Bumpiness[Lane];
+  Result.Wells = Block.Wells[Lane];
+  return Result;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+
+// The board features placement scoring is usually built from. The walls
+// count as filled on either side, and so does the floor.
+struct BoardFeatures {
+  // Rows from the floor to the highest filled cell of each column.
+  uint16_t Heights[Board::Cols];
+  // Empty cells with a filled cell somewhere above them.
+  uint16_t Holes;
+  // Changes between filled and empty from one cell to the next along each
+  // row, walls included.
+  uint16_t RowTransitions;
+  // The same down each column, from the empty space above the board to
+  // the floor.
+  uint16_t ColumnTransitions;
+  // Sum of height differences between neighbouring columns.
+  uint16_t Bumpiness;
+  // Empty cells whose left and right neighbours are both filled.
+  uint16_t Wells;
+
+  bool operator==(const BoardFeatures &Other) const;
+  bool operator!=(const BoardFeatures &Other) const {
+    return !(*this == Other);
+  }
+};
+
+// Computes the features of one board a cell at a time. Slow, and kept
+// that way as the reference that the batched kernels must match exactly.
+BoardFeatures referenceFeatures(const Board &Grid);
+
+// Computes the features of many boards in one call. Boards are stored in
+// blocks of Lanes, each block holding one row of all its boards, then the
+// next row, and so on; features come out the same way. A block is then a
+// handful of vectors wide, and each row and feature is one vector load or
+// store, so the kernels run at close to memory bandwidth.
+class BoardFeatureBatch {
+public:
+  static const int Lanes = 16;
+
+  enum Kernel {
+    // Four boards at a time in 64-bit words. Runs anywhere.
+    Scalar,
+    // Sixteen boards at a time with AVX2. Falls back to Scalar on CPUs
+    // without it.
+    Avx2,
+  };
+  // The fastest kernel this CPU supports.
+  static Kernel bestKernel();
+
+  BoardFeatureBatch() : Count(0) {}
+
+  void clear() { Count = 0; }
+  // Makes room for Boards boards, so that adding and evaluating that many
+  // allocates nothing.
+  void reserve(size_t Boards);
+  void add(const Board &Grid);
+  size_t size() const { return Count; }
+
+  // Computes the features of every board added since the last clear().
+  void evaluate() { evaluate(bestKernel()); }
+  void evaluate(Kernel K);
+
+  // The features of the Index'th board added, once evaluated.
+  BoardFeatures get(size_t Index) const;
+  uint16_t getHeight(size_t Index, int Col) const {
+    return Out[Index / Lanes].Heights[Col][Index % Lanes];
+  }
+  uint16_t getHoles(size_t Index) const {
+    return Out[Index / Lanes].Holes[Index % Lanes];
+  }
+  uint16_t getBumpiness(size_t Index) const {
+    return Out[Index / Lanes].Bumpiness[Index % Lanes];
+  }
+
+  struct RowBlock {
+    // The playfield columns of each row, as Board::getRow() returns them.
+    uint16_t Rows[Board::Rows][Lanes];
+  };
+  struct FeatureBlock {
+    uint16_t Heights[Board::Cols][Lanes];
+    uint16_t Holes[Lanes];
+    uint16_t RowTransitions[Lanes];
+    uint16_t ColumnTransitions[Lanes];
+    uint16_t Bumpiness[Lanes];
+    uint16_t Wells[Lanes];
+  };
+
+private:
+  std::vector<RowBlock> In;
+  std::vector<FeatureBlock> Out;
+  size_t Count;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "autoplayer.h"
+#include "board.h"
+#include "game.h"
+
+// Boards like the ones placement search scores, shared by the benchmarks
+// and the tests: every board the built-in player leaves behind in a few
+// games, and as many more with cells filled at random, for holes and wells
+// that play seldom makes.
+inline std::vector<Board> candidateBoards() {
+  std::vector<Board> Boards;
+  Autoplayer::Options Opts;
+  Opts.Lookahead = false;
+  Autoplayer AI(Opts);
+  TetrisGame Game;
+  for (uint64_t Seed = 0; Boards.size() < 4096; ++Seed) {
+    Game.reset(Seed, PieceGenerator::Uniform);
+    while (!Game.isGameOver() && Boards.size() < 4096 &&
+           Game.getPiecesPlaced() < 500) {
+      AI.playPiece(Game);
+      Boards.push_back(Game.getBoard());
+    }
+  }
+  uint64_t State = 1;
+  for (int i = 0; i < 4096; ++i) {
+    Board Grid;
+    for (int Row = (i * 7) % Board::Rows; Row < Board::Rows; ++Row) {
+      State = State * 6364136223846793005u + 1442695040888963407u;
+      uint64_t Bits = State >> 20;
+      for (int Col = 0; Col < Board::Cols; ++Col) {
+        if (Bits >> Col & 1) {
+          Grid.setCell(Row, Col, Tetromino::T);
+        }
+      }
+    }
+    Boards.push_back(Grid);
+  }
+  return Boards;
+}
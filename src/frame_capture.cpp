@@ -0,0 +1,348 @@
+#include "frame_capture.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+uint32_t crc32(const uint8_t *Data, size_t Size, uint32_t Crc = 0) {
+  struct Table {
+    uint32_t Entries[256];
+    Table() {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t C = i;
+        for (int k = 0; k < 8; ++k) {
+          C = C & 1 ? 0xEDB88320u ^ (C >> 1) : C >> 1;
+        }
+        Entries[i] = C;
+      }
+    }
+  };
+  static const Table T;
+  Crc = ~Crc;
+  for (size_t i = 0; i < Size; ++i) {
+    Crc = T.Entries[(Crc ^ Data[i]) & 0xFF] ^ (Crc >> 8);
+  }
+  return ~Crc;
+}
+
+void putBigEndian(std::vector<uint8_t> &Out, uint32_t Value) {
+  for (int Shift = 24; Shift >= 0; Shift -= 8) {
+    Out.push_back(uint8_t(Value >> Shift));
+  }
+}
+
+// Writes a deflate stream a bit at a time, least significant bit first.
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<uint8_t> &Out) : Out(Out), Bits(0), Count(0) {}
+
+  void put(uint32_t Value, unsigned N) {
+    Bits |= uint64_t(Value) << Count;
+    Count += N;
+    while (Count >= 8) {
+      Out.push_back(uint8_t(Bits));
+      Bits >>= 8;
+      Count -= 8;
+    }
+  }
+
+  // Huffman codes go most significant bit first.
+  void putCode(uint32_t Code, unsigned N) {
+    uint32_t Reversed = 0;
+    for (unsigned i = 0; i < N; ++i) {
+      Reversed |= ((Code >> i) & 1) << (N - 1 - i);
+    }
+    put(Reversed, N);
+  }
+
+  void flush() {
+    if (Count) {
+      Out.push_back(uint8_t(Bits));
+    }
+    Bits = 0;
+    Count = 0;
+  }
+
+private:
+  std::vector<uint8_t> &Out;
+  uint64_t Bits;
+  unsigned Count;
+};
+
+// A literal or length symbol in deflate's fixed Huffman code.
+void putSymbol(BitWriter &W, unsigned Symbol) {
+  if (Symbol < 144) {
+    W.putCode(0x30 + Symbol, 8);
+  } else if (Symbol < 256) {
+    W.putCode(0x190 + Symbol - 144, 9);
+  } else if (Symbol < 280) {
+    W.putCode(Symbol - 256, 7);
+  } else {
+    W.putCode(0xC0 + Symbol - 280, 8);
+  }
+}
+
+// A copy of the previous byte, Length (3 to 258) times over.
+void putRepeat(BitWriter &W, unsigned Length) {
+  static const uint16_t Base[] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                  15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                  67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const uint8_t Extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+  unsigned Code = std::upper_bound(Base, Base + 29, Length) - Base - 1;
+  putSymbol(W, 257 + Code);
+  W.put(Length - Base[Code], Extra[Code]);
+  // Distance 1 is distance code 0, with no extra bits.
+  W.putCode(0, 5);
+}
+
+// Compresses Data as a zlib stream of one fixed-Huffman block, in which
+// every match repeats the byte before it.
+void deflateRuns(const uint8_t *Data, size_t Size, std::vector<uint8_t> &Out) {
+  // Deflate, 32K window, no dictionary, fastest.
+  Out.push_back(0x78);
+  Out.push_back(0x01);
+  BitWriter W(Out);
+  W.put(1, 1); // last block
+  W.put(1, 2); // fixed Huffman codes
+  size_t i = 0;
+  while (i < Size) {
+    size_t Run = 0;
+    if (i) {
+      size_t Max = std::min<size_t>(Size - i, 258);
+      while (Run < Max && Data[i + Run] == Data[i - 1]) {
+        ++Run;
+      }
+    }
+    if (Run >= 3) {
+      putRepeat(W, Run);
+      i += Run;
+    } else {
+      putSymbol(W, Data[i++]);
+    }
+  }
+  putSymbol(W, 256);
+  W.flush();
+
+  uint32_t A = 1, B = 0;
+  for (size_t j = 0; j < Size;) {
+    // The most bytes before B can overflow.
+    size_t End = std::min(Size, j + 5552);
+    for (; j < End; ++j) {
+      A += Data[j];
+      B += A;
+    }
+    A %= 65521;
+    B %= 65521;
+  }
+  putBigEndian(Out, B << 16 | A);
+}
+
+void putChunk(std::vector<uint8_t> &Out, const char *Type,
+              const uint8_t *Data, size_t Size) {
+  putBigEndian(Out, Size);
+  size_t Start = Out.size();
+  Out.insert(Out.end(), Type, Type + 4);
+  Out.insert(Out.end(), Data, Data + Size);
+  putBigEndian(Out, crc32(&Out[Start], Out.size() - Start));
+}
+
+} // end anonymous namespace
+
+void encodePng(const uint8_t *Pixels, unsigned Width, unsigned Height,
+               std::vector<uint8_t> &Out) {
+  static const uint8_t Signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+                                      '\n'};
+  Out.insert(Out.end(), Signature, Signature + sizeof(Signature));
+
+  // Then 8-bit RGB, deflate, adaptive filtering, not interlaced.
+  uint8_t Header[13] = {uint8_t(Width >> 24),  uint8_t(Width >> 16),
+                        uint8_t(Width >> 8),   uint8_t(Width),
+                        uint8_t(Height >> 24), uint8_t(Height >> 16),
+                        uint8_t(Height >> 8),  uint8_t(Height),
+                        8, 2, 0, 0, 0};
+  putChunk(Out, "IHDR", Header, sizeof(Header));
+
+  // Every row is filtered against the one above, so that rows repeating
+  // the one above, which most do, come out as a run of zeros. The scratch
+  // buffers are kept per thread, so that encoding allocates nothing once
+  // a thread has encoded a frame this size.
+  static thread_local std::vector<uint8_t> Filtered, Compressed;
+  size_t RowBytes = size_t(Width) * 3;
+  Filtered.resize((RowBytes + 1) * Height);
+  uint8_t *F = Filtered.data();
+  for (unsigned Y = 0; Y < Height; ++Y) {
+    const uint8_t *Row = Pixels + size_t(Y) * Width * 4;
+    const uint8_t *Above = Row - size_t(Width) * 4;
+    *F++ = Y ? 2 : 0;
+    for (unsigned X = 0; X < Width; ++X) {
+      for (int C = 0; C < 3; ++C) {
+        *F++ = Row[X * 4 + C] - (Y ? Above[X * 4 + C] : 0);
+      }
+    }
+  }
+  Compressed.clear();
+  deflateRuns(Filtered.data(), Filtered.size(), Compressed);
+  putChunk(Out, "IDAT", Compressed.data(), Compressed.size());
+  putChunk(Out, "IEND", nullptr, 0);
+}
+
+bool FrameCapture::open(const std::string &NewPath, unsigned NewWidth,
+                        unsigned NewHeight, const Options &NewOpts) {
+  close();
+  Path = NewPath;
+  Opts = NewOpts;
+  Width = NewWidth;
+  Height = NewHeight;
+
+  if (Opts.Output == Y4m) {
+    Stream = std::fopen(Path.c_str(), "wb");
+    if (!Stream) {
+      return false;
+    }
+    std::fprintf(Stream, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", Width,
+                 Height, Opts.FramesPerSecond);
+  }
+
+  unsigned NumBuffers = std::max(Opts.Buffers, 1u);
+  Buffers.assign(NumBuffers, Buffer());
+  Free.clear();
+  for (unsigned i = 0; i < NumBuffers; ++i) {
+    Buffers[i].Pixels.resize(size_t(Width) * Height * 4);
+    Free.push_back(NumBuffers - 1 - i);
+  }
+  Ready.assign(NumBuffers, 0);
+  ReadyFirst = 0;
+  ReadyCount = 0;
+  NextFrame = 0;
+  NextToWrite = 0;
+  Stopping = false;
+  Failed = false;
+  Dropped = 0;
+
+  unsigned NumWorkers = Opts.Workers;
+  if (!NumWorkers) {
+    NumWorkers = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+  for (unsigned i = 0; i < NumWorkers; ++i) {
+    Workers.emplace_back(&FrameCapture::work, this);
+  }
+  return true;
+}
+
+uint8_t *FrameCapture::beginFrame() {
+  std::unique_lock<std::mutex> Guard(Lock);
+  if (Free.empty()) {
+    if (Opts.WhenFull == Drop) {
+      Dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    BufferFreed.wait(Guard, [&] { return !Free.empty(); });
+  }
+  Filling = Free.back();
+  Free.pop_back();
+  return Buffers[Filling].Pixels.data();
+}
+
+void FrameCapture::submitFrame() {
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Buffers[Filling].Frame = NextFrame++;
+    Ready[(ReadyFirst + ReadyCount++) % Ready.size()] = Filling;
+  }
+  FrameReady.notify_one();
+}
+
+bool FrameCapture::close() {
+  if (Workers.empty()) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Stopping = true;
+  }
+  FrameReady.notify_all();
+  for (std::thread &Worker : Workers) {
+    Worker.join();
+  }
+  Workers.clear();
+  if (Stream && std::fclose(Stream) != 0) {
+    Failed = true;
+  }
+  Stream = nullptr;
+  Buffers.clear();
+  return !Failed;
+}
+
+void FrameCapture::work() {
+  while (true) {
+    unsigned Index;
+    {
+      std::unique_lock<std::mutex> Guard(Lock);
+      FrameReady.wait(Guard, [&] { return ReadyCount || Stopping; });
+      if (!ReadyCount) {
+        return;
+      }
+      Index = Ready[ReadyFirst];
+      ReadyFirst = (ReadyFirst + 1) % Ready.size();
+      --ReadyCount;
+    }
+
+    bool Written = write(Buffers[Index]);
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Failed = Failed || !Written;
+      Free.push_back(Index);
+    }
+    BufferFreed.notify_one();
+  }
+}
+
+bool FrameCapture::write(Buffer &B) {
+  B.Encoded.clear();
+  const uint8_t *P = B.Pixels.data();
+  size_t Pixels = size_t(Width) * Height;
+
+  if (Opts.Output == Png) {
+    encodePng(P, Width, Height, B.Encoded);
+    char Name[32];
+    std::snprintf(Name, sizeof(Name), "/%06llu.png",
+                  (unsigned long long)B.Frame);
+    static thread_local std::string FileName;
+    FileName.assign(Path).append(Name);
+    std::FILE *File = std::fopen(FileName.c_str(), "wb");
+    if (!File) {
+      return false;
+    }
+    bool Good = std::fwrite(B.Encoded.data(), 1, B.Encoded.size(), File) ==
+                B.Encoded.size();
+    return std::fclose(File) == 0 && Good;
+  }
+
+  // BT.601 studio range, which is what Y4M readers assume.
+  static const char Tag[] = "FRAME\n";
+  B.Encoded.resize(sizeof(Tag) - 1 + Pixels * 3);
+  std::memcpy(B.Encoded.data(), Tag, sizeof(Tag) - 1);
+  uint8_t *Y = B.Encoded.data() + sizeof(Tag) - 1;
+  uint8_t *U = Y + Pixels, *V = U + Pixels;
+  for (size_t i = 0; i < Pixels; ++i) {
+    int R = P[i * 4], G = P[i * 4 + 1], Bl = P[i * 4 + 2];
+    Y[i] = uint8_t(16 + ((66 * R + 129 * G + 25 * Bl + 128) >> 8));
+    U[i] = uint8_t(128 + ((-38 * R - 74 * G + 112 * Bl + 128) >> 8));
+    V[i] = uint8_t(128 + ((112 * R - 94 * G - 18 * Bl + 128) >> 8));
+  }
+
+  // Frames are encoded in any order but written in the order they came.
+  std::unique_lock<std::mutex> Guard(Lock);
+  FrameWritten.wait(Guard, [&] { return NextToWrite == B.Frame; });
+  Guard.unlock();
+  bool Good = std::fwrite(B.Encoded.data(), 1, B.Encoded.size(), Stream) ==
+              B.Encoded.size();
+  Guard.lock();
+  ++NextToWrite;
+  Guard.unlock();
+  FrameWritten.notify_all();
+  return Good;
+}
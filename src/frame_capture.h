@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes frames of RGBA pixels on a pool of worker threads, either to a
+// numbered PNG file each or to one raw Y4M video stream. Frames wait to be
+// encoded in a fixed set of buffers allocated up front, so that handing
+// one over costs the caller a copy into it and nothing else, unless every
+// buffer is taken, when the policy decides between dropping the frame and
+// waiting for a worker to free one.
+class FrameCapture {
+public:
+  enum Format {
+    // DIR/000000.png, DIR/000001.png, ... in a directory that must exist.
+    // Compressed the way zlib's run-length strategy does, which suits
+    // large areas of flat colour and is cheap.
+    Png,
+    // One 4:4:4 YUV4MPEG2 stream, which ffmpeg and most players read.
+    Y4m,
+  };
+  enum Policy {
+    // Frames that arrive while every buffer is taken are dropped, so the
+    // caller never waits on an encoder.
+    Drop,
+    // The caller waits for a buffer instead, so no frame is lost.
+    Wait,
+  };
+
+  struct Options {
+    Format Output = Png;
+    Policy WhenFull = Drop;
+    // Zero means one per hardware thread, less one for the caller.
+    unsigned Workers = 0;
+    unsigned Buffers = 8;
+    // Only recorded in the Y4M header.
+    unsigned FramesPerSecond = 60;
+  };
+
+  FrameCapture()
+      : Width(0), Height(0), Stream(nullptr), NextFrame(0), Dropped(0) {}
+  ~FrameCapture() { close(); }
+
+  // Starts capturing Width x Height frames to Path, a directory for PNGs
+  // or a file for Y4M. Returns false if the Y4M file cannot be created.
+  bool open(const std::string &Path, unsigned Width, unsigned Height,
+            const Options &Opts);
+  bool isOpen() const { return !Workers.empty(); }
+
+  // A buffer for the next frame, Width * Height RGBA pixels from the top
+  // row down, to be handed over with submitFrame(). Returns null if the
+  // frame is dropped instead.
+  uint8_t *beginFrame();
+  void submitFrame();
+
+  // Waits for every frame handed over to be written and stops the
+  // workers. Returns false if any frame could not be written.
+  bool close();
+
+  unsigned getWidth() const { return Width; }
+  unsigned getHeight() const { return Height; }
+  uint64_t getSubmitted() const { return NextFrame; }
+  uint64_t getDropped() const {
+    return Dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Buffer {
+    std::vector<uint8_t> Pixels;
+    // The frame's file, or its part of the stream, reused from one frame
+    // to the next.
+    std::vector<uint8_t> Encoded;
+    uint64_t Frame;
+  };
+
+  std::string Path;
+  Options Opts;
+  unsigned Width;
+  unsigned Height;
+  std::FILE *Stream;
+
+  std::vector<Buffer> Buffers;
+  std::vector<std::thread> Workers;
+
+  // Guards everything below.
+  std::mutex Lock;
+  std::condition_variable BufferFreed;
+  std::condition_variable FrameReady;
+  std::condition_variable FrameWritten;
+  std::vector<unsigned> Free;
+  // Submitted buffers, oldest first, as a ring of Buffers.size().
+  std::vector<unsigned> Ready;
+  unsigned ReadyFirst;
+  unsigned ReadyCount;
+  unsigned Filling;
+  uint64_t NextFrame;
+  // Stream frames are written in order, whichever worker encodes them.
+  uint64_t NextToWrite;
+  bool Stopping;
+  bool Failed;
+  std::atomic<uint64_t> Dropped;
+
+  void work();
+  bool write(Buffer &B);
+};
+
+// Appends a PNG of Width x Height RGBA pixels, alpha left out, to Out.
+void encodePng(const uint8_t *Pixels, unsigned Width, unsigned Height,
+               std::vector<uint8_t> &Out);
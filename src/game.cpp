@@ -0,0 +1,360 @@
+#include "game.h"
+
+#include <utility>
+
+#include "trace.h"
+
+namespace {
+
+// Bumped whenever the snapshot layout changes.
+const uint8_t SnapshotFormat = 1;
+
+void putWord(uint8_t *&Out, uint64_t Value) {
+  for (int i = 0; i < 8; ++i) {
+    *Out++ = uint8_t(Value >> (8 * i));
+  }
+}
+
+uint64_t getWord(const uint8_t *&In) {
+  uint64_t Value = 0;
+  for (int i = 0; i < 8; ++i) {
+    Value |= uint64_t(*In++) << (8 * i);
+  }
+  return Value;
+}
+
+uint8_t packPiece(Tetromino Piece) {
+  return Piece.getKind() | Piece.getRotation() << 4;
+}
+
+// Empty (Tetromino::NumKinds) only where AllowEmpty says so.
+bool unpackPiece(uint8_t Byte, bool AllowEmpty, Tetromino &Piece) {
+  Piece = Tetromino(Tetromino::Kind(Byte & 0xF), Byte >> 4);
+  if (!Piece.isValid()) {
+    return AllowEmpty && Piece.getKind() == Tetromino::NumKinds &&
+           Piece.getRotation() == 0;
+  }
+  return Piece.getKind() < Tetromino::NumKinds &&
+         Piece.getRotation() < Piece.getNumRotations();
+}
+
+} // end anonymous namespace
+
+template <int NumRows, int NumCols>
+BasicTetrisGame<NumRows, NumCols>::BasicTetrisGame(
+    PieceGenerator::Policy Pieces)
+    : Current(Tetromino::NumKinds), Next(Tetromino::NumKinds),
+      Saved(Tetromino::NumKinds) {
+  reset(randomSeed(), Pieces);
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::reset() {
+  reset(randomSeed(), Pieces.getPolicy());
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::reset(uint64_t Seed,
+                                              PieceGenerator::Policy Policy) {
+  Pieces.reset(Seed, Policy);
+  Score = 0;
+  Level = 1;
+  Lines = 0;
+  PiecesPlaced = 0;
+  Current = Tetromino(Pieces.next());
+  Next = Tetromino(Pieces.next());
+  Saved = Tetromino(Tetromino::Kind::NumKinds);
+  CurrentPos.x = SpawnX;
+  CurrentPos.y = SpawnY;
+  Grid.clear();
+  Time = 0;
+  TickElapsed = 0;
+  Paused = false;
+  GameOver = false;
+  GhostValid = false;
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::reset(uint64_t Seed,
+                                              PieceGenerator::Policy Policy,
+                                              const Board &Start) {
+  reset(Seed, Policy);
+  Grid = Start;
+  GameOver = !currentPosIsValid();
+  GhostValid = false;
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::rotateLeft() {
+  Current.rotateLeft();
+  if (!currentPosIsValid()) {
+    Current.rotateRight();
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::rotateRight() {
+  Current.rotateRight();
+  if (!currentPosIsValid()) {
+    Current.rotateLeft();
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::moveLeft() {
+  CurrentPos.x--;
+  if (!currentPosIsValid()) {
+    CurrentPos.x++;
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::moveRight() {
+  CurrentPos.x++;
+  if (!currentPosIsValid()) {
+    CurrentPos.x--;
+  }
+}
+
+template <int NumRows, int NumCols>
+Point BasicTetrisGame<NumRows, NumCols>::downDestination() const {
+  // Falling under gravity or soft drop leaves the landing spot where it
+  // was, so only the column matters once the cache is filled.
+  if (GhostValid) {
+    return Ghost;
+  }
+  Point Result = CurrentPos;
+  // After a game over the piece overlaps the stack and stays put.
+  if (!GameOver) {
+    Result.y = Grid.dropY(Current.getShape(), CurrentPos.x, CurrentPos.y);
+  }
+  Ghost = Result;
+  GhostValid = true;
+  return Result;
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::onPieceDown() {
+  const Tetromino::Shape &Shape = Current.getShape();
+  int FirstRow = CurrentPos.y + Shape.MinY;
+  int LastRow = CurrentPos.y + Shape.MaxY;
+  Grid.place(Current, CurrentPos.x, CurrentPos.y);
+  ++PiecesPlaced;
+  CurrentPos.x = SpawnX;
+  CurrentPos.y = SpawnY;
+  Current = Next;
+  Next = Tetromino(Pieces.next());
+  TickElapsed = 0;
+  GhostValid = false;
+
+  traceInstant("piece lock", PiecesPlaced);
+  int LinesCompleted = Grid.clearFullRows(FirstRow, LastRow);
+  if (LinesCompleted) {
+    traceInstant("line clear", LinesCompleted);
+  }
+
+  Score += Pieces.between(14, 19);
+  Lines += LinesCompleted;
+  Score += LinesCompleted * 100 * (LinesCompleted == 4 ? 2 : 1);
+  Level = 1 + Lines / 10;
+
+  if (!currentPosIsValid()) {
+    GameOver = true;
+    traceInstant("game over", Score);
+    return;
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::moveDown() {
+  CurrentPos.y++;
+  if (!currentPosIsValid()) {
+    CurrentPos.y--;
+    onPieceDown();
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::jumpDown() {
+  CurrentPos = downDestination();
+  onPieceDown();
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::hold() {
+  if (!Saved.isValid()) {
+    Saved = Current;
+    Current = Next;
+    Next = Tetromino(Pieces.next());
+  } else {
+    std::swap(Current, Saved);
+    if (!currentPosIsValid()) {
+      std::swap(Current, Saved);
+    }
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::apply(Action A) {
+  if (GameOver) {
+    return;
+  }
+
+  if (A == Action::Pause) {
+    Paused = !Paused;
+    return;
+  }
+
+  if (Paused) {
+    return;
+  }
+
+  if (A != Action::SoftDrop) {
+    GhostValid = false;
+  }
+
+  switch (A) {
+  case Action::RotateLeft:
+    rotateLeft();
+    break;
+  case Action::RotateRight:
+    rotateRight();
+    break;
+  case Action::MoveLeft:
+    moveLeft();
+    break;
+  case Action::MoveRight:
+    moveRight();
+    break;
+  case Action::SoftDrop:
+    moveDown();
+    break;
+  case Action::HardDrop:
+    jumpDown();
+    break;
+  case Action::Hold:
+    hold();
+    break;
+  default:
+    break;
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::step(uint64_t Ticks) {
+  if (Paused) {
+    return;
+  }
+  Time += Ticks;
+
+  // Gravity fires at exact multiples of its period rather than on the first
+  // call after the period elapsed, which is what makes step() independent
+  // of how the caller slices time.
+  while (!GameOver && TickElapsed + Ticks >= gravityPeriod()) {
+    Ticks -= gravityPeriod() - TickElapsed;
+    TickElapsed = 0;
+    moveDown();
+  }
+  TickElapsed += Ticks;
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::addGarbage(int Count, int Hole) {
+  if (GameOver || !Count) {
+    return;
+  }
+  GhostValid = false;
+  bool Fits = Grid.addGarbage(Count, Hole);
+  while (Fits && !currentPosIsValid()) {
+    if (CurrentPos.y == 0) {
+      Fits = false;
+      break;
+    }
+    --CurrentPos.y;
+  }
+  if (!Fits) {
+    GameOver = true;
+    traceInstant("game over", Score);
+  }
+}
+
+template <int NumRows, int NumCols>
+void BasicTetrisGame<NumRows, NumCols>::save(Snapshot &Snap) const {
+  uint8_t *Out = Snap.Bytes;
+  *Out++ = SnapshotFormat;
+  *Out++ = NumRows;
+  *Out++ = NumCols;
+  for (uint64_t Word : {Score, Level, Lines, PiecesPlaced, Time, TickElapsed}) {
+    putWord(Out, Word);
+  }
+  *Out++ = packPiece(Current);
+  *Out++ = packPiece(Next);
+  *Out++ = packPiece(Saved);
+  *Out++ = uint8_t(CurrentPos.x);
+  *Out++ = uint8_t(CurrentPos.y);
+  *Out++ = Paused | GameOver << 1;
+  Pieces.pack(Out);
+  Out += PieceGenerator::PackedBytes;
+  Grid.pack(Out);
+}
+
+template <int NumRows, int NumCols>
+bool BasicTetrisGame<NumRows, NumCols>::restore(const Snapshot &Snap) {
+  const uint8_t *In = Snap.Bytes;
+  if (In[0] != SnapshotFormat || In[1] != NumRows || In[2] != NumCols) {
+    return false;
+  }
+  In += 3;
+
+  // Everything is read into a copy, which only replaces this game once it
+  // has all checked out.
+  BasicTetrisGame Game(*this);
+  uint64_t *Words[] = {&Game.Score,        &Game.Level, &Game.Lines,
+                       &Game.PiecesPlaced, &Game.Time,  &Game.TickElapsed};
+  for (uint64_t *Word : Words) {
+    *Word = getWord(In);
+  }
+  if (!unpackPiece(In[0], false, Game.Current) ||
+      !unpackPiece(In[1], false, Game.Next) ||
+      !unpackPiece(In[2], true, Game.Saved)) {
+    return false;
+  }
+  In += 3;
+  Game.CurrentPos.x = int8_t(*In++);
+  Game.CurrentPos.y = int8_t(*In++);
+  uint8_t Flags = *In++;
+  Game.Paused = Flags & 1;
+  Game.GameOver = Flags & 2;
+  if (Flags > 3 || !Game.Pieces.unpack(In)) {
+    return false;
+  }
+  In += PieceGenerator::PackedBytes;
+  if (!Game.Grid.unpack(In)) {
+    return false;
+  }
+  // The level follows from the lines, as onPieceDown() keeps it, and
+  // while the game is in play, gravity is always partway through a period;
+  // anything else would have step() drop pieces without end. A finished
+  // game's ticks keep adding up, as the screens time what follows by them.
+  if (Game.Level != 1 + Game.Lines / 10 ||
+      (!Game.GameOver && Game.TickElapsed >= Game.gravityPeriod())) {
+    return false;
+  }
+  // The piece is always somewhere the board can test, and while the game
+  // is in play, somewhere it fits.
+  if (Game.CurrentPos.y < 0 || Game.CurrentPos.y > NumRows ||
+      Game.CurrentPos.x < -Board::WallBits ||
+      Game.CurrentPos.x > Board::MaskBits - 4 - Board::WallBits) {
+    return false;
+  }
+  if (!Game.GameOver && !Game.currentPosIsValid()) {
+    return false;
+  }
+  Game.GhostValid = false;
+  *this = Game;
+  return true;
+}
+
+#define TETRIS_GAME(Rows, Cols) template class BasicTetrisGame<Rows, Cols>;
+TETRIS_BOARD_SIZES(TETRIS_GAME)
+#undef TETRIS_GAME
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "board.h"
+#include "piece_generator.h"
+#include "tetromino.h"
+
+// Inputs understood by the game rules. Frontends translate their own input
+// events into these.
+enum class Action : uint8_t {
+  RotateLeft,
+  RotateRight,
+  MoveLeft,
+  MoveRight,
+  SoftDrop,
+  HardDrop,
+  Hold,
+  Pause,
+  NumActions
+};
+
+// Board coordinates of the top-left corner of a piece's 4x4 box.
+struct Point {
+  int x, y;
+};
+
+// The rules of the game, with no dependency on any windowing or media
+// library. Game time only advances when the caller says so through step(),
+// so the same sequence of step() and apply() calls always plays out the
+// same way, whether it comes from a real-time frontend or a simulation.
+template <int NumRows, int NumCols> class BasicTetrisGame {
+public:
+  typedef BasicBoard<NumRows, NumCols> Board;
+  static const uint32_t Rows = NumRows;
+  static const uint32_t Cols = NumCols;
+  // Game time is measured in ticks of one microsecond.
+  static const uint64_t TicksPerSecond = 1000000;
+  // Where new pieces appear, centred.
+  static const int SpawnX = (NumCols - 4) / 2;
+  static const int SpawnY = 0;
+
+  explicit BasicTetrisGame(
+      PieceGenerator::Policy Pieces = PieceGenerator::Uniform);
+
+  // Starts a new game with a fresh seed.
+  void reset();
+  // Starts a new game that plays out exactly like any other game with the
+  // same seed, policy and inputs.
+  void reset(uint64_t Seed, PieceGenerator::Policy Policy);
+  // Like reset(Seed, Policy), but on a board that is already partly
+  // filled, such as a puzzle or a benchmark fixture.
+  void reset(uint64_t Seed, PieceGenerator::Policy Policy, const Board &Start);
+  void apply(Action A);
+  // Advances game time, letting the current piece fall under gravity. How
+  // the time is split across calls makes no difference: step(a + b) has the
+  // same effect as step(a) followed by step(b).
+  void step(uint64_t Ticks);
+  // Raises the stack by Count garbage rows with a gap in column Hole, as an
+  // opponent's attack. The current piece is pushed up out of the way if it
+  // can be; otherwise, or if the stack is pushed out the top, the game is
+  // over.
+  void addGarbage(int Count, int Hole);
+
+  const Board &getBoard() const { return Grid; }
+  Tetromino getCurrent() const { return Current; }
+  Tetromino getNext() const { return Next; }
+  Tetromino getSaved() const { return Saved; }
+  Point getCurrentPos() const { return CurrentPos; }
+  // Where the current piece would land, which is also where the ghost
+  // piece is drawn. Cached until the piece moves sideways, rotates or
+  // locks.
+  Point downDestination() const;
+
+  uint64_t getScore() const { return Score; }
+  uint64_t getLevel() const { return Level; }
+  uint64_t getLines() const { return Lines; }
+  uint64_t getPiecesPlaced() const { return PiecesPlaced; }
+  bool isPaused() const { return Paused; }
+  bool isGameOver() const { return GameOver; }
+  // Game time since the last reset, not counting pauses.
+  uint64_t getTime() const { return Time; }
+  // Time since the last piece locked or fell a row, not counting pauses.
+  uint64_t getTickElapsed() const { return TickElapsed; }
+  uint64_t getSeed() const { return Pieces.getSeed(); }
+  PieceGenerator::Policy getPiecePolicy() const { return Pieces.getPolicy(); }
+
+  // The whole state of a game, as a fixed number of bytes that read the
+  // same on every platform, so that a game can be suspended to disk and
+  // resumed in a later run, or forked or rewound without replaying it.
+  static const size_t SnapshotBytes =
+      3 + 6 * 8 + 3 + 2 + 1 + PieceGenerator::PackedBytes + Board::PackedBytes;
+  struct Snapshot {
+    uint8_t Bytes[SnapshotBytes];
+  };
+  void save(Snapshot &Out) const;
+  // Returns false, leaving the game as it was, if In is malformed or was
+  // saved from a game of another size or format.
+  bool restore(const Snapshot &In);
+
+private:
+  uint64_t Score;
+  uint64_t Level;
+  uint64_t Lines;
+  uint64_t PiecesPlaced;
+  Tetromino Current;
+  Tetromino Next;
+  Tetromino Saved;
+  Point CurrentPos;
+  Board Grid;
+  PieceGenerator Pieces;
+  uint64_t Time;
+  uint64_t TickElapsed;
+  bool Paused;
+  bool GameOver;
+  mutable bool GhostValid;
+  mutable Point Ghost;
+
+  bool currentPosIsValid() const {
+    return Grid.fits(Current.getShape(), CurrentPos.x, CurrentPos.y);
+  }
+  uint64_t gravityPeriod() const { return TicksPerSecond / Level; }
+
+  void rotateLeft();
+  void rotateRight();
+  void moveLeft();
+  void moveRight();
+  void moveDown();
+  void jumpDown();
+  void hold();
+  void onPieceDown();
+};
+
+template <int NumRows, int NumCols>
+const uint32_t BasicTetrisGame<NumRows, NumCols>::Rows;
+template <int NumRows, int NumCols>
+const uint32_t BasicTetrisGame<NumRows, NumCols>::Cols;
+template <int NumRows, int NumCols>
+const uint64_t BasicTetrisGame<NumRows, NumCols>::TicksPerSecond;
+template <int NumRows, int NumCols>
+const int BasicTetrisGame<NumRows, NumCols>::SpawnX;
+template <int NumRows, int NumCols>
+const int BasicTetrisGame<NumRows, NumCols>::SpawnY;
+template <int NumRows, int NumCols>
+const size_t BasicTetrisGame<NumRows, NumCols>::SnapshotBytes;
+
+typedef BasicTetrisGame<Board::Rows, Board::Cols> TetrisGame;
+
+#define TETRIS_EXTERN_GAME(Rows, Cols)                                         \
+  extern template class BasicTetrisGame<Rows, Cols>;
+TETRIS_BOARD_SIZES(TETRIS_EXTERN_GAME)
+#undef TETRIS_EXTERN_GAME
@@ -0,0 +1,116 @@
+#include "high_scores.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <functional>
+
+const unsigned HighScoreTable::MaxEntries;
+const uint32_t HighScoreTable::NoPlayer;
+
+void HighScoreTable::load(std::istream &In) {
+  std::string Line;
+  while (std::getline(In, Line)) {
+    size_t Comma = Line.rfind(',');
+    if (Comma == std::string::npos || Comma + 1 == Line.size()) {
+      continue;
+    }
+    const char *Digits = Line.c_str() + Comma + 1;
+    char *End;
+    errno = 0;
+    uint64_t Score = std::strtoull(Digits, &End, 10);
+    if (*Digits == '-' || *End || errno == ERANGE) {
+      continue;
+    }
+    addScore(Line.substr(0, Comma), Score);
+  }
+}
+
+bool HighScoreTable::isHighScore(uint64_t Score) const {
+  return Top.size() < MaxEntries || Score > Top.back().Score;
+}
+
+uint32_t HighScoreTable::playerId(const std::string &Name) {
+  auto Inserted = PlayerIds.emplace(Name, uint32_t(Players.size()));
+  if (Inserted.second) {
+    Players.push_back(Name);
+    PlayerBests.push_back(0);
+  }
+  return Inserted.first->second;
+}
+
+uint64_t HighScoreTable::addScore(const std::string &Name, uint64_t Score) {
+  uint64_t Id = Records.size();
+  uint32_t Player = NoPlayer;
+  if (!Name.empty()) {
+    Player = playerId(Name);
+    PlayerBests[Player] = std::max(PlayerBests[Player], Score);
+  }
+  Records.push_back({Score, Player});
+  Unranked.push_back(Score);
+
+  if (isHighScore(Score)) {
+    if (Top.size() == MaxEntries) {
+      Top.pop_back();
+    }
+    auto Pos = std::find_if(Top.begin(), Top.end(), [Score](const Entry &E) {
+      return E.Score < Score;
+    });
+    Top.insert(Pos, {Name, Score, Id});
+  }
+  return Id;
+}
+
+bool HighScoreTable::setName(uint64_t Id, const std::string &Name) {
+  if (Id >= Records.size() || Records[Id].Player != NoPlayer ||
+      Name.empty()) {
+    return false;
+  }
+  Record &R = Records[Id];
+  R.Player = playerId(Name);
+  PlayerBests[R.Player] = std::max(PlayerBests[R.Player], R.Score);
+  for (Entry &E : Top) {
+    if (E.Id == Id) {
+      E.Name = Name;
+    }
+  }
+  return true;
+}
+
+const std::string &HighScoreTable::getName(uint64_t Id) const {
+  static const std::string Unnamed;
+  uint32_t Player = Records[Id].Player;
+  return Player == NoPlayer ? Unnamed : Players[Player];
+}
+
+uint64_t HighScoreTable::getRank(uint64_t Score) const {
+  // A few recent scores are cheaper to scan than to merge; beyond that,
+  // merging costs one pass over Ranked, spread over the scores added since.
+  if (Unranked.size() > 1024) {
+    std::sort(Unranked.begin(), Unranked.end(), std::greater<uint64_t>());
+    size_t Middle = Ranked.size();
+    Ranked.insert(Ranked.end(), Unranked.begin(), Unranked.end());
+    std::inplace_merge(Ranked.begin(), Ranked.begin() + Middle, Ranked.end(),
+                       std::greater<uint64_t>());
+    Unranked.clear();
+  }
+
+  // The scores above Score are the ones before the first that is not.
+  uint64_t Above = std::lower_bound(Ranked.begin(), Ranked.end(), Score,
+                                    std::greater<uint64_t>()) -
+                   Ranked.begin();
+  for (uint64_t Other : Unranked) {
+    Above += Other > Score;
+  }
+  return Above + 1;
+}
+
+bool HighScoreTable::getPlayerBest(const std::string &Name,
+                                   uint64_t &Best) const {
+  auto It = PlayerIds.find(Name);
+  if (It == PlayerIds.end()) {
+    return false;
+  }
+  Best = PlayerBests[It->second];
+  return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Every score recorded, indexed so that the best few, each player's best
+// and the rank of any score can be looked up quickly however many there
+// are. Scores are numbered in the order they were added; a score can be
+// added before the player has typed their name, and named once later.
+class HighScoreTable {
+public:
+  struct Entry {
+    std::string Name;
+    uint64_t Score;
+    uint64_t Id;
+  };
+  // How many of the best scores getScores() keeps.
+  static const unsigned MaxEntries = 10;
+
+  // Adds one score per "name,score" line of the old text format, skipping
+  // lines that do not parse.
+  void load(std::istream &In);
+
+  // Whether Score would make it into getScores().
+  bool isHighScore(uint64_t Score) const;
+  // Returns the new score's Id.
+  uint64_t addScore(const std::string &Name, uint64_t Score);
+  // Names a score that was added without a name. Returns false if there is
+  // no such score or it already has a name.
+  bool setName(uint64_t Id, const std::string &Name);
+
+  // The best MaxEntries scores, highest first, earliest first among ties.
+  const std::vector<Entry> &getScores() const { return Top; }
+  uint64_t size() const { return Records.size(); }
+  uint64_t getScore(uint64_t Id) const { return Records[Id].Score; }
+  // Empty for scores that have not been named.
+  const std::string &getName(uint64_t Id) const;
+  // 1 for the best score, and one more for every score above it.
+  uint64_t getRank(uint64_t Score) const;
+  // Returns false if Name has no score.
+  bool getPlayerBest(const std::string &Name, uint64_t &Best) const;
+
+private:
+  static const uint32_t NoPlayer = UINT32_MAX;
+  struct Record {
+    uint64_t Score;
+    uint32_t Player;
+  };
+
+  std::vector<Record> Records;
+  std::vector<std::string> Players;
+  std::vector<uint64_t> PlayerBests;
+  std::unordered_map<std::string, uint32_t> PlayerIds;
+  std::vector<Entry> Top;
+
+  // Every score, highest first, for rank queries. New scores collect in
+  // Unranked and are merged in by the first query that finds enough of
+  // them, so that adding stays cheap and a bulk load sorts only once.
+  mutable std::vector<uint64_t> Ranked;
+  mutable std::vector<uint64_t> Unranked;
+
+  uint32_t playerId(const std::string &Name);
+};
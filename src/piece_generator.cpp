@@ -0,0 +1,82 @@
+#include "piece_generator.h"
+
+#include <utility>
+
+void PieceGenerator::reset(uint64_t NewSeed, Policy P) {
+  Seed = NewSeed;
+  Rng.seed(Seed);
+  Pol = P;
+  BagPos = Tetromino::NumKinds;
+}
+
+void PieceGenerator::refillBag() {
+  for (int i = 0; i < Tetromino::NumKinds; ++i) {
+    Bag[i] = Tetromino::Kind(i);
+  }
+  for (int i = Tetromino::NumKinds - 1; i > 0; --i) {
+    std::swap(Bag[i], Bag[Rng.between(0, i)]);
+  }
+  BagPos = 0;
+}
+
+void PieceGenerator::pack(uint8_t *Out) const {
+  uint32_t State[4];
+  Rng.getState(State);
+  for (int i = 0; i < 8; ++i) {
+    *Out++ = uint8_t(Seed >> (8 * i));
+  }
+  for (uint32_t Word : State) {
+    for (int i = 0; i < 4; ++i) {
+      *Out++ = uint8_t(Word >> (8 * i));
+    }
+  }
+  *Out++ = Pol;
+  *Out++ = BagPos;
+  for (Tetromino::Kind Kind : Bag) {
+    // An empty bag's contents no longer matter, and before the first
+    // refill they were never set.
+    *Out++ = BagPos < Tetromino::NumKinds ? Kind : 0;
+  }
+}
+
+bool PieceGenerator::unpack(const uint8_t *In) {
+  uint64_t NewSeed = 0;
+  for (int i = 0; i < 8; ++i) {
+    NewSeed |= uint64_t(*In++) << (8 * i);
+  }
+  uint32_t State[4] = {};
+  for (uint32_t &Word : State) {
+    for (int i = 0; i < 4; ++i) {
+      Word |= uint32_t(*In++) << (8 * i);
+    }
+  }
+  uint8_t NewPol = *In++;
+  uint8_t NewBagPos = *In++;
+  if (NewPol > SevenBag || NewBagPos > Tetromino::NumKinds) {
+    return false;
+  }
+  // Only a 7-bag game ever fills the bag, and a bag still being dealt from
+  // holds each kind exactly once.
+  if (NewBagPos < Tetromino::NumKinds) {
+    if (NewPol != SevenBag) {
+      return false;
+    }
+    unsigned Seen = 0;
+    for (int i = 0; i < Tetromino::NumKinds; ++i) {
+      if (In[i] >= Tetromino::NumKinds || Seen >> In[i] & 1) {
+        return false;
+      }
+      Seen |= 1u << In[i];
+    }
+  }
+  if (!Rng.setState(State)) {
+    return false;
+  }
+  Seed = NewSeed;
+  Pol = Policy(NewPol);
+  BagPos = NewBagPos;
+  for (int i = 0; i < Tetromino::NumKinds; ++i) {
+    Bag[i] = Tetromino::Kind(In[i]);
+  }
+  return true;
+}
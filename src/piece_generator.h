@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include "random.h"
+#include "tetromino.h"
+
+// Deals the sequence of pieces for one game, along with the game's other
+// random draws. Everything follows from the seed, so a game can be played
+// again exactly from getSeed() and getPolicy().
+class PieceGenerator {
+public:
+  enum Policy : uint8_t {
+    // Every piece is drawn independently.
+    Uniform,
+    // Pieces are dealt from shuffled bags holding one of each kind.
+    SevenBag,
+  };
+
+  PieceGenerator(uint64_t Seed = 0, Policy P = Uniform) { reset(Seed, P); }
+
+  void reset(uint64_t Seed, Policy P);
+
+  uint64_t getSeed() const { return Seed; }
+  Policy getPolicy() const { return Pol; }
+
+  Tetromino::Kind next() {
+    if (Pol == Uniform) {
+      return Tetromino::Kind(Rng.between(0, Tetromino::NumKinds - 1));
+    }
+    if (BagPos == Tetromino::NumKinds) {
+      refillBag();
+    }
+    return Bag[BagPos++];
+  }
+
+  // Draws a number in [Low, High] from the same stream as the pieces.
+  int between(int Low, int High) { return Rng.between(Low, High); }
+
+  // The seed, policy, generator state and bag, as PackedBytes bytes that
+  // read the same on every platform.
+  static const int PackedBytes = 8 + 16 + 2 + Tetromino::NumKinds;
+  void pack(uint8_t *Out) const;
+  // Returns false, changing nothing, if In is not a packed generator.
+  bool unpack(const uint8_t *In);
+
+private:
+  uint64_t Seed;
+  Random Rng;
+  Policy Pol;
+  uint8_t BagPos;
+  Tetromino::Kind Bag[Tetromino::NumKinds];
+
+  void refillBag();
+};
@@ -0,0 +1,21 @@
+#include "random.h"
+
+#include <random>
+
+void Random::seed(uint64_t Seed) {
+  // Expand the seed with splitmix64, which never produces the all-zero
+  // state xoshiro cannot leave.
+  for (int i = 0; i < 4; i += 2) {
+    uint64_t Z = (Seed += 0x9e3779b97f4a7c15);
+    Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9;
+    Z = (Z ^ (Z >> 27)) * 0x94d049bb133111eb;
+    Z ^= Z >> 31;
+    State[i] = uint32_t(Z);
+    State[i + 1] = uint32_t(Z >> 32);
+  }
+}
+
+uint64_t randomSeed() {
+  std::random_device Device;
+  return (uint64_t(Device()) << 32) | Device();
+}
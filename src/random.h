@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+// A small, fast pseudo-random generator (xoshiro128**). Its whole state is
+// sixteen bytes, seeding it is cheap, and it produces the same sequence on
+// every platform, which std::uniform_int_distribution does not guarantee.
+class Random {
+public:
+  explicit Random(uint64_t Seed = 0) { seed(Seed); }
+
+  void seed(uint64_t Seed);
+
+  // The whole state, to carry a generator across runs. setState() returns
+  // false, changing nothing, for the all-zero state, which is not one.
+  void getState(uint32_t Out[4]) const {
+    for (int i = 0; i < 4; ++i) {
+      Out[i] = State[i];
+    }
+  }
+  bool setState(const uint32_t In[4]) {
+    if (!(In[0] | In[1] | In[2] | In[3])) {
+      return false;
+    }
+    for (int i = 0; i < 4; ++i) {
+      State[i] = In[i];
+    }
+    return true;
+  }
+
+  uint32_t next() {
+    uint32_t Result = rotl(State[1] * 5, 7) * 9;
+    uint32_t T = State[1] << 9;
+    State[2] ^= State[0];
+    State[3] ^= State[1];
+    State[1] ^= State[2];
+    State[0] ^= State[3];
+    State[2] ^= T;
+    State[3] = rotl(State[3], 11);
+    return Result;
+  }
+
+  // Returns a uniformly distributed integer in [Low, High].
+  int between(int Low, int High) {
+    uint32_t Range = uint32_t(High - Low) + 1;
+    // Lemire's multiply-and-shift, rejecting the few values that would
+    // make some results more likely than others.
+    uint64_t Product = uint64_t(next()) * Range;
+    if (uint32_t(Product) < Range) {
+      uint32_t Threshold = -Range % Range;
+      while (uint32_t(Product) < Threshold) {
+        Product = uint64_t(next()) * Range;
+      }
+    }
+    return Low + int(Product >> 32);
+  }
+
+private:
+  uint32_t State[4];
+
+  static uint32_t rotl(uint32_t X, int K) { return (X << K) | (X >> (32 - K)); }
+};
+
+// Returns a seed drawn from the operating system's entropy source.
+uint64_t randomSeed();
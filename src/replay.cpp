@@ -0,0 +1,122 @@
+#include "replay.h"
+
+#include <cassert>
+
+static const char ReplayMagic[4] = {'T', 'T', 'R', 'P'};
+
+ReplayWriter::ReplayWriter(std::streambuf &Out, uint64_t Seed,
+                           PieceGenerator::Policy Policy)
+    : Out(Out), LastTime(0), Good(true) {
+  char Header[14] = {ReplayMagic[0], ReplayMagic[1], ReplayMagic[2],
+                     ReplayMagic[3], char(ReplayVersion), char(Policy)};
+  for (int i = 0; i < 8; ++i) {
+    Header[6 + i] = char(Seed >> (8 * i));
+  }
+  Good = Out.sputn(Header, sizeof(Header)) == sizeof(Header);
+}
+
+void ReplayWriter::writeEvent(uint64_t Time, uint8_t Code) {
+  assert(Time >= LastTime);
+  // The delta loses its top four bits to the code, which would take over
+  // 30000 years of game time to matter.
+  uint64_t Value = ((Time - LastTime) << 4) | Code;
+  LastTime = Time;
+  do {
+    char Byte = Value & 0x7F;
+    Value >>= 7;
+    if (Value) {
+      Byte |= 0x80;
+    }
+    Good &= Out.sputc(Byte) != std::streambuf::traits_type::eof();
+  } while (Value);
+}
+
+void ReplayWriter::record(uint64_t Time, Action A) {
+  writeEvent(Time, uint8_t(A));
+}
+
+void ReplayWriter::finish(uint64_t Time) {
+  writeEvent(Time, ReplayEnd);
+  Good &= Out.pubsync() == 0;
+}
+
+ReplayReader::ReplayReader(std::streambuf &In)
+    : In(In), Seed(0), Policy(PieceGenerator::Uniform), LastTime(0),
+      Good(false), Ended(false) {
+  char Header[14];
+  if (In.sgetn(Header, sizeof(Header)) != sizeof(Header)) {
+    return;
+  }
+  for (int i = 0; i < 4; ++i) {
+    if (Header[i] != ReplayMagic[i]) {
+      return;
+    }
+  }
+  if (uint8_t(Header[4]) != ReplayVersion ||
+      uint8_t(Header[5]) > PieceGenerator::SevenBag) {
+    return;
+  }
+  Policy = PieceGenerator::Policy(Header[5]);
+  for (int i = 0; i < 8; ++i) {
+    Seed |= uint64_t(uint8_t(Header[6 + i])) << (8 * i);
+  }
+  Good = true;
+}
+
+bool ReplayReader::next(uint64_t &Time, Action &A) {
+  if (!Good || Ended) {
+    Time = LastTime;
+    return false;
+  }
+
+  uint64_t Value = 0;
+  for (int Shift = 0;; Shift += 7) {
+    int Byte = In.sbumpc();
+    if (Byte == std::streambuf::traits_type::eof() || Shift > 63) {
+      Good = false;
+      Time = LastTime;
+      return false;
+    }
+    Value |= uint64_t(Byte & 0x7F) << Shift;
+    if (!(Byte & 0x80)) {
+      break;
+    }
+  }
+
+  LastTime += Value >> 4;
+  Time = LastTime;
+  uint8_t Code = Value & 0xF;
+  if (Code == ReplayEnd) {
+    Ended = true;
+    return false;
+  }
+  if (Code >= uint8_t(Action::NumActions)) {
+    Good = false;
+    return false;
+  }
+  A = Action(Code);
+  return true;
+}
+
+ReplayPlayer::ReplayPlayer(ReplayReader &Reader, TetrisGame &Game)
+    : Reader(Reader), Game(Game), PendingTime(0),
+      PendingAction(Action::NumActions), HasPending(false), Finished(false) {
+  Game.reset(Reader.getSeed(), Reader.getPolicy());
+  HasPending = Reader.next(PendingTime, PendingAction);
+}
+
+bool ReplayPlayer::advanceTo(uint64_t Time) {
+  while (!Finished && PendingTime <= Time) {
+    Game.step(PendingTime - Game.getTime());
+    if (!HasPending) {
+      Finished = true;
+      break;
+    }
+    Game.apply(PendingAction);
+    HasPending = Reader.next(PendingTime, PendingAction);
+  }
+  if (!Finished && Time > Game.getTime()) {
+    Game.step(Time - Game.getTime());
+  }
+  return !Finished;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <streambuf>
+
+#include "game.h"
+
+// Replays store what is needed to play a game again exactly: the seed and
+// piece policy, then every action with the game time it was applied at.
+//
+// The format is a 14-byte header, the magic "TTRP", a version byte, the
+// policy byte and the seed as 8 little-endian bytes, followed by one
+// LEB128 varint per event. An event packs the ticks elapsed since the
+// previous event above the low four bits, which hold the Action, or
+// ReplayEnd for the final event that marks when recording stopped.
+static const uint8_t ReplayVersion = 1;
+static const uint8_t ReplayEnd = 0xF;
+
+static_assert(uint8_t(Action::NumActions) <= ReplayEnd,
+              "actions must fit in the low bits of an event");
+
+// Writes a replay as the game is played.
+class ReplayWriter {
+public:
+  ReplayWriter(std::streambuf &Out, uint64_t Seed,
+               PieceGenerator::Policy Policy);
+
+  void record(uint64_t Time, Action A);
+  void finish(uint64_t Time);
+
+  bool good() const { return Good; }
+
+private:
+  std::streambuf &Out;
+  uint64_t LastTime;
+  bool Good;
+
+  void writeEvent(uint64_t Time, uint8_t Code);
+};
+
+// Reads a replay one event at a time, without buffering it in memory.
+class ReplayReader {
+public:
+  explicit ReplayReader(std::streambuf &In);
+
+  // False if the header was missing or malformed, or an event was cut off.
+  bool good() const { return Good; }
+  uint64_t getSeed() const { return Seed; }
+  PieceGenerator::Policy getPolicy() const { return Policy; }
+
+  // Reads the next action and the time it was applied at. Returns false at
+  // the end of the replay, with Time set to when recording stopped.
+  bool next(uint64_t &Time, Action &A);
+
+private:
+  std::streambuf &In;
+  uint64_t Seed;
+  PieceGenerator::Policy Policy;
+  uint64_t LastTime;
+  bool Good;
+  bool Ended;
+};
+
+// Drives a TetrisGame from a replay, at whatever pace the caller chooses.
+class ReplayPlayer {
+public:
+  // Resets Game to the replay's seed and policy.
+  ReplayPlayer(ReplayReader &Reader, TetrisGame &Game);
+
+  // Advances the game to the given game time, applying every action
+  // recorded before it. Returns false once the whole replay has played.
+  bool advanceTo(uint64_t Time);
+  // Plays the rest of the replay as fast as possible.
+  void runToEnd() { advanceTo(UINT64_MAX); }
+
+  bool finished() const { return Finished; }
+  // Time of the next recorded event.
+  uint64_t nextEventTime() const { return PendingTime; }
+
+private:
+  ReplayReader &Reader;
+  TetrisGame &Game;
+  uint64_t PendingTime;
+  Action PendingAction;
+  bool HasPending;
+  bool Finished;
+};
@@ -0,0 +1,259 @@
+#include "score_journal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+const char Magic[4] = {'T', 'T', 'H', 'S'};
+const size_t HeaderSize = 5;
+const char ScoreRecord = 'S';
+const char NameRecord = 'N';
+// Kind, name length and score ahead of the name; the CRC after it.
+const size_t FixedSize = 10;
+const size_t CrcSize = 4;
+
+uint32_t crc32(const char *Data, size_t Size) {
+  static const struct Table {
+    uint32_t Entries[256];
+    Table() {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t C = i;
+        for (int k = 0; k < 8; ++k) {
+          C = C & 1 ? 0xEDB88320 ^ (C >> 1) : C >> 1;
+        }
+        Entries[i] = C;
+      }
+    }
+  } Crc;
+  uint32_t C = 0xFFFFFFFF;
+  for (size_t i = 0; i < Size; ++i) {
+    C = Crc.Entries[(C ^ uint8_t(Data[i])) & 0xFF] ^ (C >> 8);
+  }
+  return ~C;
+}
+
+std::string header() {
+  return std::string(Magic, sizeof(Magic)) + char(ScoreJournalVersion);
+}
+
+// Names longer than 255 bytes are cut short.
+std::string encode(char Kind, const std::string &Name, uint64_t Score) {
+  size_t Length = std::min<size_t>(Name.size(), 255);
+  std::string Record(FixedSize + Length + CrcSize, '\0');
+  Record[0] = Kind;
+  Record[1] = char(Length);
+  for (int i = 0; i < 8; ++i) {
+    Record[2 + i] = char(Score >> (8 * i));
+  }
+  Record.replace(FixedSize, Length, Name, 0, Length);
+  uint32_t Crc = crc32(Record.data(), FixedSize + Length);
+  for (int i = 0; i < 4; ++i) {
+    Record[FixedSize + Length + i] = char(Crc >> (8 * i));
+  }
+  return Record;
+}
+
+bool writeAll(int Fd, const char *Data, size_t Size) {
+  while (Size) {
+    ssize_t Written = ::write(Fd, Data, Size);
+    if (Written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    Data += Written;
+    Size -= Written;
+  }
+  return true;
+}
+
+// Makes a new or renamed file in Path's directory survive a crash.
+bool syncDirectory(const std::string &Path) {
+  size_t Slash = Path.rfind('/');
+  std::string Dir =
+      Slash == std::string::npos ? "." : Path.substr(0, Slash + 1);
+  int Fd = ::open(Dir.c_str(), O_RDONLY);
+  if (Fd < 0) {
+    return false;
+  }
+  bool Good = ::fsync(Fd) == 0;
+  ::close(Fd);
+  return Good;
+}
+
+} // end anonymous namespace
+
+bool readScoreJournal(std::streambuf &In, HighScoreTable &Table,
+                      uint64_t &Valid) {
+  std::string Header(HeaderSize, '\0');
+  if (In.sgetn(&Header[0], HeaderSize) != std::streamsize(HeaderSize) ||
+      Header != header()) {
+    return false;
+  }
+  Valid = HeaderSize;
+
+  uint64_t LastScore = UINT64_MAX;
+  char Record[FixedSize + 255 + CrcSize];
+  while (In.sgetn(Record, FixedSize) == std::streamsize(FixedSize)) {
+    size_t Length = uint8_t(Record[1]);
+    if (In.sgetn(Record + FixedSize, Length + CrcSize) !=
+        std::streamsize(Length + CrcSize)) {
+      break;
+    }
+    uint32_t Crc = 0;
+    for (int i = 0; i < 4; ++i) {
+      Crc |= uint32_t(uint8_t(Record[FixedSize + Length + i])) << (8 * i);
+    }
+    if (Crc != crc32(Record, FixedSize + Length)) {
+      break;
+    }
+
+    std::string Name(Record + FixedSize, Length);
+    if (Record[0] == ScoreRecord) {
+      uint64_t Score = 0;
+      for (int i = 0; i < 8; ++i) {
+        Score |= uint64_t(uint8_t(Record[2 + i])) << (8 * i);
+      }
+      LastScore = Table.addScore(Name, Score);
+    } else if (Record[0] == NameRecord) {
+      Table.setName(LastScore, Name);
+    } else {
+      break;
+    }
+    Valid += FixedSize + Length + CrcSize;
+  }
+  return true;
+}
+
+bool writeScoreJournal(const std::string &Path, const HighScoreTable &Table) {
+  std::string Temp = Path + ".tmp";
+  int Fd = ::open(Temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (Fd < 0) {
+    return false;
+  }
+  // Records are written in batches rather than one call each.
+  std::string Buffer = header();
+  bool Good = true;
+  for (uint64_t Id = 0, E = Table.size(); Id != E && Good; ++Id) {
+    Buffer += encode(ScoreRecord, Table.getName(Id), Table.getScore(Id));
+    if (Buffer.size() >= 1 << 16) {
+      Good = writeAll(Fd, Buffer.data(), Buffer.size());
+      Buffer.clear();
+    }
+  }
+  Good = Good && writeAll(Fd, Buffer.data(), Buffer.size()) &&
+         ::fsync(Fd) == 0;
+  Good &= ::close(Fd) == 0;
+  if (!Good || std::rename(Temp.c_str(), Path.c_str()) != 0) {
+    std::remove(Temp.c_str());
+    return false;
+  }
+  return syncDirectory(Path);
+}
+
+bool ScoreJournal::open(const std::string &NewPath, HighScoreTable &Table) {
+  close();
+  Path = NewPath;
+  Fd = ::open(Path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (Fd < 0) {
+    return false;
+  }
+
+  uint64_t Valid = 0;
+  uint64_t Before = Table.size();
+  std::filebuf File;
+  if (!File.open(Path, std::ios::in | std::ios::binary)) {
+    close();
+    return false;
+  }
+  if (File.pubseekoff(0, std::ios::end, std::ios::in) >=
+      std::streamoff(HeaderSize)) {
+    File.pubseekpos(0, std::ios::in);
+    if (!readScoreJournal(File, Table, Valid)) {
+      // Not a journal; leave it alone.
+      close();
+      return false;
+    }
+  }
+  File.close();
+
+  // Anything past the last good record is a write that a crash cut off,
+  // and a file too short for a header was cut off while being created.
+  off_t End = ::lseek(Fd, 0, SEEK_END);
+  if (End < 0 || (uint64_t(End) != Valid &&
+                  (::ftruncate(Fd, Valid) != 0 || ::fsync(Fd) != 0))) {
+    close();
+    return false;
+  }
+  Size = Valid;
+  Waste = Size;
+  if (Size) {
+    Waste -= HeaderSize;
+    for (uint64_t Id = Before, E = Table.size(); Id != E; ++Id) {
+      Waste -= FixedSize + Table.getName(Id).size() + CrcSize;
+    }
+  }
+  if (!Size) {
+    std::string Header = header();
+    if (!writeAll(Fd, Header.data(), Header.size()) || ::fsync(Fd) != 0 ||
+        !syncDirectory(Path)) {
+      close();
+      return false;
+    }
+    Size = Header.size();
+  }
+  return true;
+}
+
+void ScoreJournal::close() {
+  if (Fd >= 0) {
+    ::close(Fd);
+    Fd = -1;
+  }
+}
+
+bool ScoreJournal::append(const std::string &Record) {
+  // A single write, so that a crash leaves at most this record torn.
+  if (Fd < 0 || !writeAll(Fd, Record.data(), Record.size()) ||
+      ::fsync(Fd) != 0) {
+    return false;
+  }
+  Size += Record.size();
+  return true;
+}
+
+bool ScoreJournal::appendScore(const std::string &Name, uint64_t Score) {
+  return append(encode(ScoreRecord, Name, Score));
+}
+
+bool ScoreJournal::appendName(const std::string &Name) {
+  std::string Record = encode(NameRecord, Name, 0);
+  if (!append(Record)) {
+    return false;
+  }
+  Waste += Record.size();
+  return true;
+}
+
+bool ScoreJournal::compact(const HighScoreTable &Table) {
+  if (Fd < 0 || !writeScoreJournal(Path, Table)) {
+    return false;
+  }
+  // Appends have to go to the new file.
+  close();
+  Fd = ::open(Path.c_str(), O_WRONLY | O_APPEND);
+  if (Fd < 0) {
+    return false;
+  }
+  off_t End = ::lseek(Fd, 0, SEEK_END);
+  Size = End < 0 ? 0 : End;
+  Waste = 0;
+  return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+#include "high_scores.h"
+
+// Scores are kept on disk in an append-only journal, so that each one is
+// safely stored as soon as it is recorded, and a crash can at worst cut
+// off the record that was being written.
+//
+// The file is the magic "TTHS" and a version byte, then one record per
+// change: a kind byte, the length of the name, the score as 8 little-endian
+// bytes, the name, and a CRC-32 of the rest of the record. A score record
+// adds a score; a name record names the last score in the same file, which
+// is recorded before the player has typed their name.
+static const uint8_t ScoreJournalVersion = 1;
+
+// Adds the scores of a journal to Table, up to the first record that is
+// cut off or fails its checksum. Returns false if the header is missing or
+// malformed; otherwise sets Valid to the length of the good part.
+bool readScoreJournal(std::streambuf &In, HighScoreTable &Table,
+                      uint64_t &Valid);
+
+// Writes every score in Table to a fresh journal at Path. The file at Path
+// is replaced only once the new one is completely on disk, so a crash
+// leaves either the old file or the new one.
+bool writeScoreJournal(const std::string &Path, const HighScoreTable &Table);
+
+// The journal that a game session records its scores into.
+class ScoreJournal {
+public:
+  ScoreJournal() : Fd(-1), Size(0), Waste(0) {}
+  ~ScoreJournal() { close(); }
+  ScoreJournal(const ScoreJournal &) = delete;
+  ScoreJournal &operator=(const ScoreJournal &) = delete;
+
+  // Adds the scores in the journal at Path to Table and opens it for
+  // appending, creating it if there is none. A record cut off by a crash
+  // is dropped from the file.
+  bool open(const std::string &Path, HighScoreTable &Table);
+  void close();
+
+  // Each returns only once the record is on disk.
+  bool appendScore(const std::string &Name, uint64_t Score);
+  bool appendName(const std::string &Name);
+
+  // True once a quarter of the file is name records, which a compacted
+  // journal folds into the scores they name.
+  bool needsCompaction() const { return Waste * 4 > Size; }
+  // Replaces the journal with one record per score in Table, which must
+  // hold exactly what was read and appended since open().
+  bool compact(const HighScoreTable &Table);
+
+private:
+  std::string Path;
+  int Fd;
+  uint64_t Size;
+  uint64_t Waste;
+
+  bool append(const std::string &Record);
+};
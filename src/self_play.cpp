@@ -0,0 +1,172 @@
+#include "self_play.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "game.h"
+
+namespace {
+
+// The games a worker has left, [Begin, End). The owner takes from the
+// front and thieves split off the back, so both rarely touch the same
+// games. The padding keeps neighbouring ranges off each other's cache
+// lines (alignas would need C++17's aligned new).
+struct WorkRange {
+  std::mutex Lock;
+  uint64_t Begin = 0;
+  uint64_t End = 0;
+  char Padding[64];
+
+  bool pop(uint64_t &Index) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    if (Begin == End) {
+      return false;
+    }
+    Index = Begin++;
+    return true;
+  }
+
+  uint64_t size() {
+    std::lock_guard<std::mutex> Guard(Lock);
+    return End - Begin;
+  }
+};
+
+class Scheduler {
+public:
+  Scheduler(uint64_t Games, unsigned Workers)
+      : Ranges(new WorkRange[Workers]), NumWorkers(Workers), Steals(0) {
+    for (unsigned i = 0; i < Workers; ++i) {
+      Ranges[i].Begin = Games * i / Workers;
+      Ranges[i].End = Games * (i + 1) / Workers;
+    }
+  }
+
+  // Returns the next game for Worker to play, or false once every game has
+  // been handed out.
+  bool next(unsigned Worker, uint64_t &Index) {
+    while (true) {
+      if (Ranges[Worker].pop(Index)) {
+        return true;
+      }
+      if (!steal(Worker)) {
+        return false;
+      }
+    }
+  }
+
+  uint64_t getSteals() const { return Steals; }
+
+private:
+  std::unique_ptr<WorkRange[]> Ranges;
+  unsigned NumWorkers;
+  std::atomic<uint64_t> Steals;
+
+  // Moves the back half of the fullest other range to Worker's own.
+  bool steal(unsigned Worker) {
+    while (true) {
+      unsigned Victim = Worker;
+      uint64_t Largest = 0;
+      for (unsigned i = 0; i < NumWorkers; ++i) {
+        uint64_t Size = i == Worker ? 0 : Ranges[i].size();
+        if (Size > Largest) {
+          Largest = Size;
+          Victim = i;
+        }
+      }
+      if (Largest == 0) {
+        return false;
+      }
+
+      uint64_t Begin, End;
+      {
+        std::lock_guard<std::mutex> Guard(Ranges[Victim].Lock);
+        uint64_t Size = Ranges[Victim].End - Ranges[Victim].Begin;
+        if (Size == 0) {
+          // Someone else got there first; look again.
+          continue;
+        }
+        End = Ranges[Victim].End;
+        Begin = End - (Size + 1) / 2;
+        Ranges[Victim].End = Begin;
+      }
+      std::lock_guard<std::mutex> Guard(Ranges[Worker].Lock);
+      Ranges[Worker].Begin = Begin;
+      Ranges[Worker].End = End;
+      ++Steals;
+      return true;
+    }
+  }
+};
+
+template <int NumRows, int NumCols>
+void playGame(BasicTetrisGame<NumRows, NumCols> &Game,
+              BasicAutoplayer<NumRows, NumCols> &AI,
+              const SelfPlayOptions &Opts, uint64_t Seed,
+              SelfPlayGame &Result) {
+  Game.reset(Seed, Opts.Policy);
+  while (!Game.isGameOver() &&
+         (Opts.MaxPieces == 0 || Game.getPiecesPlaced() < Opts.MaxPieces)) {
+    AI.playPiece(Game);
+  }
+  Result.Seed = Seed;
+  Result.Score = Game.getScore();
+  Result.Lines = Game.getLines();
+  Result.Level = Game.getLevel();
+  Result.Pieces = Game.getPiecesPlaced();
+  Result.ToppedOut = Game.isGameOver();
+}
+
+template <int NumRows, int NumCols>
+void playAll(const SelfPlayOptions &Opts, SelfPlayResults &Results) {
+  Results.Games.resize(Opts.Games);
+
+  Scheduler Work(Opts.Games, Results.Threads);
+  auto Worker = [&](unsigned Id) {
+    // One player for all of a worker's games, so that its search buffers
+    // are only allocated once.
+    BasicTetrisGame<NumRows, NumCols> Game(Opts.Policy);
+    BasicAutoplayer<NumRows, NumCols> AI(Opts.AI);
+    uint64_t Index;
+    while (Work.next(Id, Index)) {
+      playGame(Game, AI, Opts, Opts.FirstSeed + Index, Results.Games[Index]);
+    }
+  };
+
+  auto Start = std::chrono::steady_clock::now();
+  std::vector<std::thread> Threads;
+  for (unsigned i = 1; i < Results.Threads; ++i) {
+    Threads.emplace_back(Worker, i);
+  }
+  Worker(0);
+  for (std::thread &Thread : Threads) {
+    Thread.join();
+  }
+  Results.Seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - Start)
+                        .count();
+  Results.Steals = Work.getSteals();
+}
+
+} // end anonymous namespace
+
+SelfPlayResults runSelfPlay(const SelfPlayOptions &Opts) {
+  SelfPlayResults Results;
+  Results.Threads = Opts.Threads;
+  if (Results.Threads == 0) {
+    Results.Threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  Results.Seconds = 0;
+  Results.Steals = 0;
+#define TETRIS_PLAY_ALL(R, C)                                                  \
+  if (Opts.Rows == R && Opts.Cols == C) {                                      \
+    playAll<R, C>(Opts, Results);                                              \
+  }
+  TETRIS_BOARD_SIZES(TETRIS_PLAY_ALL)
+#undef TETRIS_PLAY_ALL
+  return Results;
+}
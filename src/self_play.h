@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "autoplayer.h"
+#include "piece_generator.h"
+
+// Plays many headless games with the Autoplayer on every core at once.
+//
+// Games are split into one contiguous range of seeds per worker. A worker
+// that runs out of games steals the upper half of the largest range left,
+// so a few long games do not leave the other cores idle.
+struct SelfPlayOptions {
+  uint64_t Games = 1000;
+  // Game i is played with seed FirstSeed + i.
+  uint64_t FirstSeed = 0;
+  PieceGenerator::Policy Policy = PieceGenerator::Uniform;
+  // One of TETRIS_BOARD_SIZES.
+  int Rows = Board::Rows;
+  int Cols = Board::Cols;
+  Autoplayer::Options AI;
+  // A good player may never top out, so every game stops after this many
+  // pieces. Zero means no limit.
+  uint64_t MaxPieces = 1000;
+  // Zero means one per hardware thread.
+  unsigned Threads = 0;
+};
+
+struct SelfPlayGame {
+  uint64_t Seed;
+  uint64_t Score;
+  uint64_t Lines;
+  uint64_t Level;
+  uint64_t Pieces;
+  bool ToppedOut;
+};
+
+struct SelfPlayResults {
+  // In seed order, whichever worker played them.
+  std::vector<SelfPlayGame> Games;
+  double Seconds;
+  unsigned Threads;
+  uint64_t Steals;
+};
+
+// Plays no games if the board size is not one that is compiled in.
+SelfPlayResults runSelfPlay(const SelfPlayOptions &Opts);
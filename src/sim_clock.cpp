@@ -0,0 +1,20 @@
+#include "sim_clock.h"
+
+const uint64_t SimClock::StepTicks;
+const uint64_t SimClock::MaxCatchUp;
+const unsigned SimClock::MaxPending;
+
+void SimClock::reset() {
+  Time = 0;
+  First = 0;
+  Count = 0;
+}
+
+bool SimClock::input(uint64_t At, Action A) {
+  if (Count == MaxPending) {
+    return false;
+  }
+  Pending[(First + Count) % MaxPending] = {At, A};
+  ++Count;
+  return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include "game.h"
+
+// Drives a TetrisGame from a real-time clock in fixed steps of game time,
+// so that how often frames are drawn has no effect on the game. Inputs are
+// stamped with the real time they happened and applied at the start of the
+// step that time falls in, rather than whenever the next frame gets to
+// them. The game time of every input is then a whole number of steps, and
+// replaying the same inputs at the same times plays out the same game on
+// any machine.
+//
+// Real time is in the game's ticks, on any clock the caller likes, as long
+// as input() and advanceTo() use the same one.
+class SimClock {
+public:
+  static const uint64_t StepTicks = TetrisGame::TicksPerSecond / 1000;
+  // The most real time simulated by one advanceTo(). After a longer stall
+  // the game falls behind real time rather than running a burst of steps.
+  static const uint64_t MaxCatchUp = TetrisGame::TicksPerSecond / 4;
+  static const unsigned MaxPending = 64;
+
+  explicit SimClock(TetrisGame &Game) : Game(Game) { reset(); }
+
+  // Starts over at real time zero, dropping pending inputs.
+  void reset();
+
+  // Queues an input that happened at real time At. Returns false, dropping
+  // the input, if MaxPending inputs are already waiting.
+  bool input(uint64_t At, Action A);
+
+  // Runs every whole step up to real time Now, calling Apply(Action) for
+  // each queued input at the start of its step. Apply is expected to pass
+  // the action on to the game, and may record it.
+  template <typename Fn> void advanceTo(uint64_t Now, Fn Apply);
+
+  // Real time simulated so far.
+  uint64_t getTime() const { return Time; }
+
+private:
+  struct Input {
+    uint64_t At;
+    Action A;
+  };
+
+  TetrisGame &Game;
+  uint64_t Time;
+  Input Pending[MaxPending];
+  unsigned First;
+  unsigned Count;
+};
+
+template <typename Fn> void SimClock::advanceTo(uint64_t Now, Fn Apply) {
+  if (Now > Time + MaxCatchUp) {
+    Time = Now - MaxCatchUp;
+  }
+  while (true) {
+    // Inputs from before the current step, including any left behind by
+    // the catch-up limit, go in at its start.
+    while (Count && Pending[First].At < Time + StepTicks) {
+      Apply(Pending[First].A);
+      First = (First + 1) % MaxPending;
+      --Count;
+    }
+    if (Time + StepTicks > Now) {
+      break;
+    }
+    Game.step(StepTicks);
+    Time += StepTicks;
+  }
+}
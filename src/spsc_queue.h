@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// A fixed-capacity queue between exactly one producer thread and one
+// consumer thread, without locks. Neither side ever waits on the other, and
+// nothing is allocated after construction.
+template <typename T, size_t Capacity> class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  SpscQueue() : Head(0), Tail(0) {}
+
+  // Producer only. Returns false if the queue is full.
+  bool push(const T &Item) {
+    size_t T0 = Tail.load(std::memory_order_relaxed);
+    if (T0 - Head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    Items[T0 % Capacity] = Item;
+    Tail.store(T0 + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false if the queue is empty.
+  bool pop(T &Item) {
+    size_t H = Head.load(std::memory_order_relaxed);
+    if (H == Tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    Item = Items[H % Capacity];
+    Head.store(H + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  // Each index is written by one side only; the padding keeps them, and
+  // the items, on separate cache lines.
+  std::atomic<size_t> Head;
+  char HeadPadding[64];
+  std::atomic<size_t> Tail;
+  char TailPadding[64];
+  T Items[Capacity];
+};
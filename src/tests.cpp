@@ -0,0 +1,391 @@
+// Checks that must hold exactly, whatever the timings say, run by ctest
+// one at a time. Each check prints what went wrong and returns false when
+// it fails.
+//
+// Usage: tetris_tests [NAME...]
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_count.h"
+#include "autoplayer.h"
+#include "board.h"
+#include "board_features.h"
+#include "fixtures.h"
+#include "game.h"
+#include "sim_clock.h"
+#include "trace.h"
+#include "triple_buffer.h"
+
+namespace {
+
+// Checks that every kernel this CPU supports matches the reference exactly
+// on every board.
+bool checkBoardFeatures() {
+  std::vector<Board> Boards = candidateBoards();
+  BoardFeatureBatch Batch;
+  for (const Board &Grid : Boards) {
+    Batch.add(Grid);
+  }
+
+  struct {
+    const char *Name;
+    BoardFeatureBatch::Kernel Kernel;
+  } Kernels[] = {{"scalar", BoardFeatureBatch::Scalar},
+                 {"avx2", BoardFeatureBatch::Avx2}};
+  for (const auto &K : Kernels) {
+    if (K.Kernel > BoardFeatureBatch::bestKernel()) {
+      std::cout << "skipping " << K.Name << ", not supported here\n";
+      continue;
+    }
+    Batch.evaluate(K.Kernel);
+    for (size_t i = 0; i < Boards.size(); ++i) {
+      if (Batch.get(i) != referenceFeatures(Boards[i])) {
+        std::cerr << K.Name << " board features differ from the reference "
+                  << "on board " << i << '\n';
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Runs the simulation side of the game screen's frame loop, as its
+// simulation thread does, with the AI playing: a step a millisecond, an
+// input from the AI each step, a snapshot published for every frame, and
+// a new game whenever one ends, which the AI's games are cut short to do
+// every GameTicks. Past the first frames, which may set up caches, checks
+// that no frame allocates.
+bool checkFrameAllocations() {
+  const unsigned WarmupFrames = 60, Frames = 60 * 60;
+  const uint64_t FrameTicks = TetrisGame::TicksPerSecond / 60;
+  const uint64_t GameTicks = 15 * TetrisGame::TicksPerSecond;
+  Autoplayer AI;
+  TetrisGame Game;
+  Game.reset(1, PieceGenerator::Uniform);
+  SimClock Sim(Game);
+  TripleBuffer<TetrisGame> Snapshots;
+  uint64_t Seed = 1;
+  uint64_t Now = 0;
+
+  auto Frame = [&] {
+    for (uint64_t End = Now + FrameTicks; Now < End;
+         Now += SimClock::StepTicks) {
+      if (Game.isGameOver() || Now >= GameTicks) {
+        Game.reset(++Seed, PieceGenerator::Uniform);
+        Sim.reset();
+        Now = 0;
+        break;
+      }
+      Sim.input(Now, AI.nextAction(Game));
+      Sim.advanceTo(Now, [&](Action A) { Game.apply(A); });
+    }
+    Snapshots.back() = Game;
+    Snapshots.publish();
+    Snapshots.read();
+  };
+
+  for (unsigned i = 0; i < WarmupFrames; ++i) {
+    Frame();
+  }
+  for (unsigned i = 0; i < Frames; ++i) {
+    uint64_t Before = allocationCount();
+    Frame();
+    if (uint64_t N = allocationCount() - Before) {
+      std::cerr << "frame " << WarmupFrames + i << " made " << N
+                << " allocations\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks that a game restored from a snapshot, into a game that was doing
+// something else, plays on exactly like the one it was saved from.
+bool checkSnapshotRoundTrip() {
+  Autoplayer::Options Opts;
+  Opts.Lookahead = false;
+  Autoplayer AI(Opts);
+  TetrisGame Game;
+  Game.reset(3, PieceGenerator::SevenBag);
+  Game.apply(Action::Hold);
+  for (int i = 0; i < 30; ++i) {
+    AI.playPiece(Game);
+  }
+
+  TetrisGame::Snapshot Snap, Expected, Actual;
+  Game.save(Snap);
+  TetrisGame Copy;
+  Copy.reset(4, PieceGenerator::Uniform);
+  if (!Copy.restore(Snap)) {
+    std::cerr << "snapshot did not restore\n";
+    return false;
+  }
+  for (int i = 0; i < 20000 && !Game.isGameOver(); ++i) {
+    Action A = AI.nextAction(Game);
+    Game.apply(A);
+    Copy.apply(A);
+    Game.step(SimClock::StepTicks);
+    Copy.step(SimClock::StepTicks);
+    Game.save(Expected);
+    Copy.save(Actual);
+    if (std::memcmp(Expected.Bytes, Actual.Bytes, sizeof(Expected.Bytes))) {
+      std::cerr << "restored game differs after " << i << " steps\n";
+      return false;
+    }
+  }
+
+  // A finished game's ticks run on past the gravity period while the
+  // screens wait to move on from it.
+  TetrisGame Finished;
+  Finished.reset(7, PieceGenerator::Uniform);
+  while (!Finished.isGameOver()) {
+    Finished.apply(Action::HardDrop);
+  }
+  Finished.step(2 * TetrisGame::TicksPerSecond);
+  Finished.save(Expected);
+  if (!Copy.restore(Expected)) {
+    std::cerr << "snapshot of a finished game did not restore\n";
+    return false;
+  }
+  Copy.save(Actual);
+  if (std::memcmp(Expected.Bytes, Actual.Bytes, sizeof(Expected.Bytes))) {
+    std::cerr << "restored finished game differs\n";
+    return false;
+  }
+  return true;
+}
+
+// Offsets of the fields restore() checks, as save() lays them out: the
+// header, then six little-endian words, then the three pieces.
+const size_t LevelOffset = 3 + 8, LinesOffset = 3 + 2 * 8,
+             TickElapsedOffset = 3 + 5 * 8, PosOffset = 3 + 6 * 8 + 3,
+             FlagsOffset = PosOffset + 2, BagPosOffset = FlagsOffset + 26;
+
+void putWordAt(TetrisGame::Snapshot &Snap, size_t Offset, uint64_t Value) {
+  for (int i = 0; i < 8; ++i) {
+    Snap.Bytes[Offset + i] = uint8_t(Value >> (8 * i));
+  }
+}
+
+// Checks that restore() turns away snapshots that would leave a game it
+// cannot play on from, and leaves the game as it was when it does.
+bool checkSnapshotRejects() {
+  TetrisGame Game;
+  Game.reset(5, PieceGenerator::Uniform);
+  TetrisGame::Snapshot Good;
+  Game.save(Good);
+
+  struct {
+    const char *What;
+    void (*Corrupt)(TetrisGame::Snapshot &);
+  } Cases[] = {
+    {"another board size",
+     [](TetrisGame::Snapshot &Snap) {
+       BasicTetrisGame<40, 10> Tall;
+       BasicTetrisGame<40, 10>::Snapshot TallSnap;
+       Tall.save(TallSnap);
+       std::memcpy(Snap.Bytes, TallSnap.Bytes, 3);
+     }},
+    {"level zero",
+     [](TetrisGame::Snapshot &Snap) { putWordAt(Snap, LevelOffset, 0); }},
+    {"a level the lines do not give",
+     [](TetrisGame::Snapshot &Snap) { putWordAt(Snap, LevelOffset, 2); }},
+    {"a level with no gravity period",
+     [](TetrisGame::Snapshot &Snap) {
+       putWordAt(Snap, LinesOffset, 10 * TetrisGame::TicksPerSecond);
+       putWordAt(Snap, LevelOffset, 1 + TetrisGame::TicksPerSecond);
+     }},
+    {"gravity past its period",
+     [](TetrisGame::Snapshot &Snap) {
+       putWordAt(Snap, TickElapsedOffset, TetrisGame::TicksPerSecond);
+     }},
+    {"a piece below the board",
+     [](TetrisGame::Snapshot &Snap) { Snap.Bytes[PosOffset + 1] = 0xff; }},
+    {"a piece off the side of a finished game",
+     [](TetrisGame::Snapshot &Snap) {
+       Snap.Bytes[PosOffset] = 100;
+       Snap.Bytes[FlagsOffset] = 2;
+     }},
+    {"a piece below a finished game",
+     [](TetrisGame::Snapshot &Snap) {
+       Snap.Bytes[PosOffset + 1] = 100;
+       Snap.Bytes[FlagsOffset] = 2;
+     }},
+    {"a 7-bag holding a kind twice",
+     [](TetrisGame::Snapshot &Snap) {
+       Snap.Bytes[BagPosOffset - 1] = PieceGenerator::SevenBag;
+       Snap.Bytes[BagPosOffset] = 0;
+       for (int i = 0; i < Tetromino::NumKinds; ++i) {
+         Snap.Bytes[BagPosOffset + 1 + i] = i == 3 ? 2 : i;
+       }
+     }},
+  };
+
+  TetrisGame::Snapshot Before, After;
+  for (const auto &C : Cases) {
+    TetrisGame::Snapshot Bad = Good;
+    C.Corrupt(Bad);
+    TetrisGame Target;
+    Target.reset(6, PieceGenerator::SevenBag);
+    Target.save(Before);
+    if (Target.restore(Bad)) {
+      std::cerr << "restored a snapshot with " << C.What << '\n';
+      return false;
+    }
+    Target.save(After);
+    if (std::memcmp(Before.Bytes, After.Bytes, sizeof(Before.Bytes))) {
+      std::cerr << "rejecting a snapshot with " << C.What
+                << " changed the game\n";
+      return false;
+    }
+  }
+  TetrisGame Target;
+  if (!Target.restore(Good)) {
+    std::cerr << "snapshot of a new game did not restore\n";
+    return false;
+  }
+  return true;
+}
+
+// Checks that playPiece() carries out a placement that takes many more
+// inputs than a small board ever needs: on a 64x64 board, an O piece
+// tucked into a cave at the bottom of a narrow shaft, which fills holes
+// where every other placement adds height.
+bool checkAutoplayerLongPath() {
+  typedef BasicTetrisGame<64, 64> BigGame;
+  typedef BigGame::Board BigBoard;
+  const int Rows = BigBoard::Rows, Cols = BigBoard::Cols;
+  BigBoard Grid;
+  for (int Row = 10; Row < Rows; ++Row) {
+    for (int Col = 2; Col < Cols - 1; ++Col) {
+      // The cave: the bottom two rows, under the stack beside the shaft.
+      if (Row < Rows - 2 || Col >= 8) {
+        Grid.setCell(Row, Col, Tetromino::T);
+      }
+    }
+  }
+
+  BigGame Game;
+  for (uint64_t Seed = 0;; ++Seed) {
+    Game.reset(Seed, PieceGenerator::Uniform, Grid);
+    if (Game.getCurrent().getKind() == Tetromino::O) {
+      break;
+    }
+  }
+  Autoplayer::Options Opts;
+  Opts.UseHold = false;
+  Opts.Lookahead = false;
+  BasicAutoplayer<64, 64> AI(Opts);
+  Placement Chosen = AI.choose(Game);
+  const Tetromino::Shape &Shape = Chosen.Piece.getShape();
+  if (Chosen.Pos.x + Shape.MinX < 2 ||
+      Chosen.Pos.y + Shape.MinY < Rows - 2) {
+    std::cerr << "expected a tuck into the cave, chose (" << Chosen.Pos.x
+              << ", " << Chosen.Pos.y << ")\n";
+    return false;
+  }
+
+  BigBoard Expected = Grid;
+  Expected.place(Chosen.Piece, Chosen.Pos.x, Chosen.Pos.y);
+  AI.playPiece(Game);
+  for (int Row = 0; Row < Rows; ++Row) {
+    if (Game.getBoard().getRow(Row) != Expected.getRow(Row)) {
+      std::cerr << "the piece did not land where chosen; row " << Row
+                << " differs\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks that dumping a trace while another thread records into it only
+// ever writes out whole events: the thread alternates spans one tick long
+// with instants, so a torn event shows up as a span of another length or
+// an instant that names the span.
+bool checkTraceWhileRecording() {
+  enableTracing(true);
+  std::atomic<bool> Stop(false);
+  std::thread Recorder([&] {
+    setTraceThreadName("recorder");
+    for (uint64_t i = 1; !Stop.load(std::memory_order_relaxed); ++i) {
+      traceSpan("span", i * 1000, i * 1000 + 1);
+      traceInstant("instant", i);
+    }
+  });
+
+  bool Passed = true;
+  for (int Dump = 0; Dump < 20 && Passed; ++Dump) {
+    std::ostringstream Out;
+    writeChromeTrace(Out);
+    std::istringstream In(Out.str());
+    for (std::string Line; std::getline(In, Line);) {
+      bool Span = Line.find("\"name\":\"span\"") != std::string::npos;
+      bool Instant = Line.find("\"name\":\"instant\"") != std::string::npos;
+      if ((Span && Line.find("\"ph\":\"X\",\"dur\":0.001}") ==
+                       std::string::npos) ||
+          (Instant && Line.find("\"ph\":\"i\"") == std::string::npos)) {
+        std::cerr << "torn event in dump " << Dump << ": " << Line << '\n';
+        Passed = false;
+        break;
+      }
+    }
+  }
+  Stop.store(true, std::memory_order_relaxed);
+  Recorder.join();
+  enableTracing(false);
+  return Passed;
+}
+
+struct Test {
+  const char *Name;
+  bool (*Run)();
+};
+
+const Test Tests[] = {
+  {"board_features", checkBoardFeatures},
+  {"frame_allocations", checkFrameAllocations},
+  {"autoplayer_long_path", checkAutoplayerLongPath},
+  {"trace_while_recording", checkTraceWhileRecording},
+  {"snapshot_round_trip", checkSnapshotRoundTrip},
+  {"snapshot_rejects", checkSnapshotRejects},
+};
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  std::vector<const Test *> Selected;
+  for (int i = 1; i < argc; ++i) {
+    const Test *Found = nullptr;
+    for (const Test &T : Tests) {
+      if (!std::strcmp(T.Name, argv[i])) {
+        Found = &T;
+      }
+    }
+    if (!Found) {
+      std::cerr << "no test named " << argv[i] << '\n';
+      return 1;
+    }
+    Selected.push_back(Found);
+  }
+  if (Selected.empty()) {
+    for (const Test &T : Tests) {
+      Selected.push_back(&T);
+    }
+  }
+
+  int Failed = 0;
+  for (const Test *T : Selected) {
+    bool Passed = T->Run();
+    std::cout << (Passed ? "PASS " : "FAIL ") << T->Name << '\n';
+    Failed += !Passed;
+  }
+  return Failed ? 1 : 0;
+}
@@ -1,28 +1,56 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
-#include <ctime>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
-#include <map>
-#include <random>
-#include <sstream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <unistd.h>
+
 #include <SFML/Audio.hpp>
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
+// Capture reads frames back through pixel buffer objects, from OpenGL 2.1.
+#define GL_GLEXT_PROTOTYPES
+#include <SFML/OpenGL.hpp>
 
 #include "config.h"
+#include "alloc_count.h"
+#include "autoplayer.h"
+#include "frame_capture.h"
+#include "game.h"
+#include "high_scores.h"
+#include "replay.h"
+#include "score_journal.h"
+#include "self_play.h"
+#include "sim_clock.h"
+#include "spsc_queue.h"
+#include "transposition.h"
+#include "trace.h"
+#include "triple_buffer.h"
+#include "versus.h"
+
+// BSD and macOS headers provide this; glibc does not.
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
 
 class Mode {
 public:
   virtual void handleEvent(const sf::Event &Event __unused) {}
   virtual void update() {}
-  virtual void display(sf::RenderWindow &Window __unused, sf::Font &Font __unused) {}
+  virtual void display(sf::RenderTarget &Window __unused, sf::Font &Font __unused) {}
 };
 
 template<typename T>
@@ -32,89 +60,209 @@ static void centerTextHorizontally(sf::Text &Text, T &HasSize) {
   Text.setPosition(X, Text.getPosition().y);
 }
 
-const unsigned int MAX_HIGH_SCORES = 10;
+// UI that only depends on the window size, drawn once into a texture and
+// then put on screen as a single sprite each frame. It is redrawn only
+// when the window size changes, i.e. after an sf::Event::Resized.
+class StaticLayer {
+private:
+  sf::RenderTexture Texture;
+  sf::Vector2u Size;
+
+public:
+  // Draws the layer over the whole window, first calling Build to redraw
+  // it into an sf::RenderTexture if needed. Returns whether it did, so
+  // that callers can lay out their dynamic elements again.
+  template<typename F>
+  bool draw(sf::RenderTarget &Window, F Build) {
+    bool Rebuilt = false;
+    if (Window.getSize() != Size) {
+      Size = Window.getSize();
+      Texture.create(Size.x, Size.y);
+      Texture.clear(sf::Color::Black);
+      Build(Texture);
+      Texture.display();
+      Rebuilt = true;
+    }
+    Window.draw(sf::Sprite(Texture.getTexture()));
+    return Rebuilt;
+  }
+};
+
+// A number drawn in place of an sf::Text, whose setString() allocates. The
+// digits' quads are laid out from the font's glyphs into a fixed array, so
+// setting a new number allocates nothing once the font has rasterised the
+// digits at this size, which setFont() makes sure of.
+class NumberText : public sf::Drawable, public sf::Transformable {
+private:
+  // Enough for any uint64_t.
+  static const unsigned MaxDigits = 20;
+
+  const sf::Font *Font;
+  unsigned Size;
+  sf::Vertex Quads[MaxDigits * 4];
+  unsigned NumVertices;
+
+  void draw(sf::RenderTarget &Target, sf::RenderStates States) const {
+    if (!NumVertices) {
+      return;
+    }
+    States.transform *= getTransform();
+    States.texture = &Font->getTexture(Size);
+    Target.draw(Quads, NumVertices, sf::Quads, States);
+  }
+
+public:
+  NumberText() : Font(nullptr), Size(0), NumVertices(0) {}
+
+  void setFont(const sf::Font &NewFont, unsigned NewSize) {
+    Font = &NewFont;
+    Size = NewSize;
+    for (char C = '0'; C <= '9'; ++C) {
+      Font->getGlyph(C, Size, false);
+    }
+    NumVertices = 0;
+  }
+
+  void setNumber(uint64_t Value) {
+    assert(Font);
+    char Digits[MaxDigits];
+    unsigned N = 0;
+    do {
+      Digits[MaxDigits - ++N] = '0' + Value % 10;
+      Value /= 10;
+    } while (Value);
+
+    // The same layout as sf::Text: glyphs sit on a baseline one character
+    // size down, advance by their width plus kerning, and take a pixel of
+    // padding around them for smoothing.
+    const float Padding = 1;
+    float X = 0, Y = Size;
+    sf::Uint32 Prev = 0;
+    NumVertices = 0;
+    for (unsigned i = MaxDigits - N; i < MaxDigits; ++i) {
+      X += Font->getKerning(Prev, Digits[i], Size);
+      Prev = Digits[i];
+      const sf::Glyph &Glyph = Font->getGlyph(Digits[i], Size, false);
+      float Left = X + Glyph.bounds.left - Padding;
+      float Top = Y + Glyph.bounds.top - Padding;
+      float Right = Left + Glyph.bounds.width + 2 * Padding;
+      float Bottom = Top + Glyph.bounds.height + 2 * Padding;
+      float U0 = Glyph.textureRect.left - Padding;
+      float V0 = Glyph.textureRect.top - Padding;
+      float U1 = U0 + Glyph.textureRect.width + 2 * Padding;
+      float V1 = V0 + Glyph.textureRect.height + 2 * Padding;
+      sf::Vertex *Quad = &Quads[NumVertices];
+      Quad[0] = sf::Vertex(sf::Vector2f(Left, Top), sf::Vector2f(U0, V0));
+      Quad[1] = sf::Vertex(sf::Vector2f(Right, Top), sf::Vector2f(U1, V0));
+      Quad[2] = sf::Vertex(sf::Vector2f(Right, Bottom), sf::Vector2f(U1, V1));
+      Quad[3] = sf::Vertex(sf::Vector2f(Left, Bottom), sf::Vector2f(U0, V1));
+      NumVertices += 4;
+      X += Glyph.advance;
+    }
+  }
+};
+
 class HighScores : public Mode {
 private:
-  std::vector<std::pair<std::string, uint64_t>> Scores;
+  HighScoreTable Table;
+  ScoreJournal Journal;
+  // False when the journal could not be opened, in which case scores are
+  // only kept for this session.
+  bool Saving;
   bool PlayerIsTyping;
-  std::string *PlayerNameInput;
+  // The score being named, and the name typed so far.
+  uint64_t PlayerScoreId;
+  std::string PlayerName;
   std::function<void()> EndCallback;
 
-  std::string *addScore(std::string Name, uint64_t Score);
+  StaticLayer Chrome;
+  std::vector<sf::Text> Lines;
+  // Each line's text is put together here, reusing one buffer.
+  std::string LineText;
+  bool LinesChanged;
+
 public:
-  void loadFromFile(const char *Path);
-  void saveToFile(const char *Path);
-  bool isHighScore(uint64_t Score);
-  void recordNewHighScore(uint64_t Score);
+  HighScores()
+      : Saving(false), PlayerIsTyping(false), PlayerScoreId(0),
+        LinesChanged(true) {}
+  // Returns false if scores will not be saved, though the table still
+  // holds whatever could be read.
+  bool open(const char *Path, const char *LegacyPath);
+  void close();
+  // Records the score of every finished game, and returns its rank.
+  uint64_t recordScore(uint64_t Score);
+  // Whether the last recorded score made the table and needs a name.
+  bool needsName() const { return PlayerIsTyping; }
   void handleEvent(const sf::Event &Event);
-  void display(sf::RenderWindow &Window, sf::Font &Font);
+  void display(sf::RenderTarget &Window, sf::Font &Font);
   void setEndCallback(std::function<void()> Callback);
 };
 
-void HighScores::loadFromFile(const char *Path) {
-  std::ifstream Stream;
-  Stream.open(Path);
-  assert(!Stream.fail());
-
-  std::string Line;
-  while (std::getline(Stream, Line)) {
-    size_t Comma = Line.find(',');
-    assert(Comma != std::string::npos);
-    std::string Name = Line.substr(0, Comma);
-    int Score = std::stoi(Line.substr(Comma + 1));
-    assert(Score >= 0);
-    addScore(Name, (uint64_t) Score);
+// Opens the score journal at Path. If there is none yet, the scores saved
+// by older versions at LegacyPath are carried over into a new one.
+bool HighScores::open(const char *Path, const char *LegacyPath) {
+  LinesChanged = true;
+  std::ifstream Legacy;
+  if (access(Path, F_OK) != 0) {
+    Legacy.open(LegacyPath);
   }
-  assert(Scores.size() <= MAX_HIGH_SCORES);
-
-  std::sort(Scores.begin(), Scores.end(), [](auto &a, auto &b) {
-    return b.second < a.second;
-  });
-}
-
-void HighScores::saveToFile(const char *Path) {
-  std::ofstream Stream;
-  Stream.open(Path);
-  assert(!Stream.fail());
-
-  for (auto &Entry : Scores) {
-    Stream << Entry.first << ',' << Entry.second << '\n';
+  if (Legacy.is_open()) {
+    Table.load(Legacy);
+    if (!writeScoreJournal(Path, Table)) {
+      return false;
+    }
+    Table = HighScoreTable();
+  }
+  Saving = Journal.open(Path, Table);
+  if (!Saving) {
+    return false;
   }
+  // A journal that was not compacted is still good to append to.
+  if (Journal.needsCompaction() && !Journal.compact(Table)) {
+    std::cerr << "could not compact " << Path << '\n';
+  }
+  return true;
 }
 
-bool HighScores::isHighScore(uint64_t Score) {
-  return Scores.size() < MAX_HIGH_SCORES ||
-    Score > Scores.back().second;
+void HighScores::close() {
+  if (Saving && Journal.needsCompaction()) {
+    Journal.compact(Table);
+  }
+  Journal.close();
 }
 
-std::string *HighScores::addScore(std::string Name, uint64_t Score) {
-  assert(isHighScore(Score));
-  if (Scores.size() == MAX_HIGH_SCORES) {
-    Scores.pop_back();
+uint64_t HighScores::recordScore(uint64_t Score) {
+  // The score is stored before the player starts typing a name, so that
+  // it survives even if the game does not.
+  bool Listed = Table.isHighScore(Score);
+  uint64_t Id = Table.addScore("", Score);
+  if (Saving && !Journal.appendScore("", Score)) {
+    std::cerr << "could not record score " << Score << '\n';
   }
-  auto Pos = std::find_if(Scores.begin(), Scores.end(), [Score](auto &e) {
-    return e.second < Score;
-  });
-  return &(*Scores.insert(Pos, std::make_pair(Name, Score))).first;
+  if (Listed) {
+    PlayerIsTyping = true;
+    PlayerScoreId = Id;
+    PlayerName.clear();
+    LinesChanged = true;
+  }
+  return Table.getRank(Score);
 }
 
 void HighScores::setEndCallback(std::function<void()> Callback) {
   EndCallback = Callback;
 }
 
-void HighScores::recordNewHighScore(uint64_t Score) {
-  PlayerIsTyping = true;
-  PlayerNameInput = addScore("", Score);
-}
-
 void HighScores::handleEvent(const sf::Event &Event) {
   if (Event.type == sf::Event::KeyPressed &&
       Event.key.code == sf::Keyboard::Return) {
     if (PlayerIsTyping) {
-      assert(PlayerNameInput);
-      if (!PlayerNameInput->empty()) {
+      if (!PlayerName.empty()) {
+        Table.setName(PlayerScoreId, PlayerName);
+        if (Saving && !Journal.appendName(PlayerName)) {
+          std::cerr << "could not record name " << PlayerName << '\n';
+        }
         PlayerIsTyping = false;
-        PlayerNameInput = nullptr;
+        LinesChanged = true;
         return;
       }
     } else {
@@ -129,37 +277,54 @@ void HighScores::handleEvent(const sf::Event &Event) {
   }
 
   if (Event.type == sf::Event::TextEntered) {
+    LinesChanged = true;
     if (Event.text.unicode == '\b') {
-      if (!PlayerNameInput->empty()) {
-        PlayerNameInput->erase(PlayerNameInput->size() - 1, 1);
+      if (!PlayerName.empty()) {
+        PlayerName.erase(PlayerName.size() - 1, 1);
       }
     } else if (isalpha(Event.text.unicode)) {
-      *PlayerNameInput += Event.text.unicode;
+      PlayerName += Event.text.unicode;
     }
   }
 }
 
-void HighScores::display(sf::RenderWindow &Window, sf::Font &Font) {
+void HighScores::display(sf::RenderTarget &Window, sf::Font &Font) {
   unsigned Height = Window.getSize().y;
-  sf::Text HighScoreLabel("HIGH SCORES", Font, Height / 8);
-  HighScoreLabel.setPosition(0, 0);
-  centerTextHorizontally(HighScoreLabel, Window);
-  Window.draw(HighScoreLabel);
-
-  unsigned Index = 1;
-  for (auto &Entry : Scores) {
-    std::stringstream Line;
-    Line << Index++ << ". " << Entry.first << " " << Entry.second;
-    sf::Text Label(Line.str(), Font, Height / 15);
+  bool Resized = Chrome.draw(Window, [&](sf::RenderTexture &Target) {
+    sf::Text HighScoreLabel("HIGH SCORES", Font, Height / 8);
+    HighScoreLabel.setPosition(0, 0);
+    centerTextHorizontally(HighScoreLabel, Target);
+    Target.draw(HighScoreLabel);
+  });
 
-    if (&Entry.first == PlayerNameInput) {
-      Label.setFillColor(sf::Color::Yellow);
+  if (Resized || LinesChanged) {
+    auto &Scores = Table.getScores();
+    Lines.resize(Scores.size());
+    for (unsigned I = 0, E = Scores.size(); I != E; ++I) {
+      auto &Entry = Scores[I];
+      bool Typing = PlayerIsTyping && Entry.Id == PlayerScoreId;
+      char Rank[16], Score[24];
+      std::snprintf(Rank, sizeof(Rank), "%u. ", I + 1);
+      std::snprintf(Score, sizeof(Score), " %llu",
+                    (unsigned long long)Entry.Score);
+      LineText.assign(Rank)
+          .append(Typing ? PlayerName : Entry.Name)
+          .append(Score);
+      sf::Text &Label = Lines[I];
+      Label.setFont(Font);
+      Label.setCharacterSize(Height / 15);
+      Label.setString(LineText);
+      Label.setFillColor(Typing ? sf::Color::Yellow : sf::Color::White);
+
+      float ItemHeight = (3 * Height / 4) / HighScoreTable::MaxEntries;
+      float Y = (Height / 6) + ItemHeight * (I + 1);
+      Label.setPosition(0, Y);
+      centerTextHorizontally(Label, Window);
     }
+    LinesChanged = false;
+  }
 
-    float ItemHeight = (3 * Height / 4) / MAX_HIGH_SCORES;
-    float Y = (Height / 6) + ItemHeight * (Index - 1);
-    Label.setPosition(0, Y);
-    centerTextHorizontally(Label, Window);
+  for (auto &Label : Lines) {
     Window.draw(Label);
   }
 }
@@ -169,11 +334,14 @@ private:
   std::vector<std::pair<std::string, std::function<void()>>> MenuItems;
   unsigned Index;
 
+  StaticLayer Chrome;
+  std::vector<sf::Text> Labels;
+
 public:
-  Menu() {}
+  Menu() : Index(0) {}
   void addMenuItem(std::string Label, std::function<void()> Action);
   void handleEvent(const sf::Event &Event);
-  void display(sf::RenderWindow &Window, sf::Font &Font);
+  void display(sf::RenderTarget &Window, sf::Font &Font);
 };
 
 void Menu::addMenuItem(std::string Label, std::function<void()> Action) {
@@ -190,7 +358,7 @@ void Menu::handleEvent(const sf::Event &Event) {
       Index = (Index + 1) % MenuItems.size();
       break;
     case sf::Keyboard::Return:
-      assert(0 <= Index && Index < MenuItems.size());
+      assert(Index < MenuItems.size());
       MenuItems[Index].second();
       Index = 0;
       break;
@@ -200,725 +368,1940 @@ void Menu::handleEvent(const sf::Event &Event) {
   }
 }
 
-void Menu::display(sf::RenderWindow &Window, sf::Font &Font) {
+void Menu::display(sf::RenderTarget &Window, sf::Font &Font) {
   unsigned Height = Window.getSize().y;
-  sf::Text Logo("TETRIS", Font, Height / 4);
-  Logo.setPosition(0, 0);
-  centerTextHorizontally(Logo, Window);
-  Window.draw(Logo);
+  bool Resized = Chrome.draw(Window, [&](sf::RenderTexture &Target) {
+    sf::Text Logo("TETRIS", Font, Height / 4);
+    Logo.setPosition(0, 0);
+    centerTextHorizontally(Logo, Target);
+    Target.draw(Logo);
+  });
 
-  for (unsigned I = 0, E = MenuItems.size(); I != E; ++I) {
-    sf::Text Label(MenuItems[I].first, Font, Height / 15);
-    if (I == Index) {
-      Label.setFillColor(sf::Color::Yellow);
+  if (Resized || Labels.size() != MenuItems.size()) {
+    Labels.resize(MenuItems.size());
+    for (unsigned I = 0, E = MenuItems.size(); I != E; ++I) {
+      sf::Text &Label = Labels[I];
+      Label.setFont(Font);
+      Label.setCharacterSize(Height / 15);
+      Label.setString(MenuItems[I].first);
+
+      float ItemHeight = (Height / 2.0f) / MenuItems.size();
+      float Y = (Height / 2.0f) + ItemHeight * I;
+      Label.setPosition(0, Y);
+      centerTextHorizontally(Label, Window);
     }
+  }
 
-    float ItemHeight = (Height / 2.0f) / MenuItems.size();
-    float Y = (Height / 2.0f) + ItemHeight * I;
-    Label.setPosition(0, Y);
-    centerTextHorizontally(Label, Window);
-    Window.draw(Label);
+  for (unsigned I = 0, E = Labels.size(); I != E; ++I) {
+    Labels[I].setFillColor(I == Index ? sf::Color::Yellow : sf::Color::White);
+    Window.draw(Labels[I]);
   }
 }
 
-class PausableClock {
-  sf::Clock Clock;
+// Plays a TetrisGame in the window, driving it with keyboard input and
+// wall-clock time.
+class GameScreen : public Mode {
+private:
+  // Requests from the render thread to the simulation thread.
+  struct Command {
+    enum Kind : uint8_t { Input, Start, Stop, SetAutoplayer, Quit };
+    Kind Type;
+    Action A;
+    // When an input happened, on the steady clock, in ticks.
+    uint64_t At;
+    Autoplayer *Player;
+  };
 
-  bool Paused;
-  sf::Clock Pause;
-  sf::Time TimeSpentPaused;
+  // Sent back when a game ends, tagged with the Start it belongs to, so
+  // that one crossing a Stop on its way is recognised as stale.
+  struct GameOver {
+    uint64_t Generation;
+    uint64_t Score;
+  };
+
+  // Render thread state. The game itself is only seen through the
+  // snapshots the simulation publishes, and every callback runs here.
+  bool Active;
+  bool Autoplaying;
+  uint64_t Generation;
+  std::function<void(uint64_t)> EndCallback;
+  std::function<void()> ExitCallback;
+
+  std::thread Thread;
+  SpscQueue<Command, 256> Commands;
+  SpscQueue<GameOver, 16> GameOvers;
+  TripleBuffer<TetrisGame> Snapshots;
+
+  // Simulation thread state, from the moment the thread starts. Before
+  // that, main() sets it up directly.
+  TetrisGame Game;
+  SimClock Sim;
+  uint64_t StartTime;
+  bool Running;
+  uint64_t RunningGeneration;
+  bool HasFixedSeed;
+  uint64_t FixedSeed;
+
+  // Plays instead of the keyboard when set, one input per tick, and starts
+  // a new game whenever one ends.
+  Autoplayer *AI;
+
+  // Where each game is recorded to, if anywhere.
+  const char *RecordPath;
+  std::filebuf RecordFile;
+  std::unique_ptr<ReplayWriter> Recorder;
+
+  // Set when showing a replay instead of taking input. A speed of zero
+  // means one replay event per tick, as fast as the simulation runs.
+  std::unique_ptr<ReplayPlayer> Playback;
+  float PlaybackSpeed;
+
+  void send(Command::Kind Type, Action A = Action::NumActions,
+            Autoplayer *Player = nullptr);
+  void simulate();
+  void tick(uint64_t Now);
+  void start(uint64_t Now);
+  void apply(Action A);
+  void endGame();
+
+  // Every block drawn in a frame, five quads each. The board, the ghost and
+  // current pieces, and the next and saved previews make at most MaxBlocks.
+  static const unsigned MaxBlocks = TetrisGame::Rows * TetrisGame::Cols + 4 * 4;
+  sf::VertexArray Blocks;
+  size_t NumBlockVertices;
+
+  void addBlock(sf::Vector2f Pos, float Size, sf::Color Outline,
+                sf::Color Fill);
+
+  // The boxes and labels, and the values shown next to them. Each value is
+  // only laid out again when it changes.
+  StaticLayer Chrome;
+  NumberText ScoreValue;
+  NumberText LinesValue;
+  NumberText LevelValue;
+  sf::Text PausedText;
+  uint64_t ShownScore;
+  uint64_t ShownLines;
+  uint64_t ShownLevel;
 
 public:
-  PausableClock() {}
+  GameScreen(PieceGenerator::Policy Pieces)
+      : Active(false), Autoplaying(false), Generation(0), Game(Pieces),
+        Sim(Game), StartTime(0), Running(false), RunningGeneration(0),
+        HasFixedSeed(false), FixedSeed(0), AI(nullptr), RecordPath(nullptr),
+        PlaybackSpeed(1), Blocks(sf::Quads, MaxBlocks * 5 * 4),
+        NumBlockVertices(0), ShownScore(UINT64_MAX), ShownLines(UINT64_MAX),
+        ShownLevel(UINT64_MAX) {
+    Snapshots.back() = Game;
+    Snapshots.publish();
+  }
+  ~GameScreen();
+  // Makes every game deal the same pieces, from the given seed.
+  void fixSeed(uint64_t Seed);
+  // Records every game to Path, each one replacing the last.
+  void recordTo(const char *Path) { RecordPath = Path; }
+  // Shows a replay at Speed times real time instead of taking input.
+  void playReplay(ReplayReader &Reader, float Speed);
+  void skipToEndOfReplay();
+  // Hands the game over to Player, or back to the keyboard if null.
+  void setAutoplayer(Autoplayer *Player);
+  void handleEvent(const sf::Event &Event);
+  void update();
+  void display(sf::RenderTarget &Window, sf::Font &Font);
+  void setEndCallback(std::function<void(uint64_t)> Callback);
+  // Called when the player leaves a game the AI is playing.
+  void setExitCallback(std::function<void()> Callback);
+};
+
+// Indexed by Tetromino::Kind, then empty cells and garbage.
+static const sf::Color COLORS[Board::Garbage + 1] = {
+  sf::Color::White,
+  sf::Color::Red,
+  sf::Color::Yellow,
+  sf::Color::Blue,
+  sf::Color::Magenta,
+  sf::Color::Cyan,
+  sf::Color::Green,
+  sf::Color::Black,
+  sf::Color(0x60, 0x60, 0x60),
+};
+
+// Ticks on the clock shared by both threads.
+static uint64_t steadyNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
-  sf::Time getElapsedTime() {
-    return Clock.getElapsedTime() - TimeSpentPaused -
-      (Paused ? Pause.getElapsedTime() : sf::Time::Zero);
+static_assert(TetrisGame::TicksPerSecond == 1000000,
+              "steadyNow() counts microseconds");
+
+GameScreen::~GameScreen() {
+  if (Thread.joinable()) {
+    send(Command::Quit);
+    Thread.join();
   }
+}
+
+void GameScreen::setEndCallback(std::function<void(uint64_t)> Callback) {
+  EndCallback = Callback;
+}
+
+void GameScreen::setExitCallback(std::function<void()> Callback) {
+  ExitCallback = Callback;
+}
 
-  sf::Time restart() {
-    sf::Time ElapsedTime = getElapsedTime();
-    Paused = false;
-    Clock.restart();
-    TimeSpentPaused = sf::Time::Zero;
-    return ElapsedTime;
+void GameScreen::send(Command::Kind Type, Action A, Autoplayer *Player) {
+  Command C = {Type, A, steadyNow(), Player};
+  // The simulation drains the queue every millisecond, so it only fills
+  // up if that thread is stuck; an input lost then is the least of it.
+  while (!Commands.push(C) && Type != Command::Input) {
+    std::this_thread::yield();
   }
+}
+
+void GameScreen::setAutoplayer(Autoplayer *Player) {
+  Autoplaying = Player != nullptr;
+  send(Command::SetAutoplayer, Action::NumActions, Player);
+}
 
-  void pause() {
-    assert(!Paused);
-    Paused = true;
-    Pause.restart();
+// Returns Action::NumActions for keys that do not control the game.
+static Action keyAction(sf::Keyboard::Key Key) {
+  switch (Key) {
+  case sf::Keyboard::P:
+    return Action::Pause;
+  case sf::Keyboard::Up:
+  case sf::Keyboard::X:
+    return Action::RotateRight;
+  case sf::Keyboard::Z:
+    return Action::RotateLeft;
+  case sf::Keyboard::Left:
+    return Action::MoveLeft;
+  case sf::Keyboard::Right:
+    return Action::MoveRight;
+  case sf::Keyboard::Down:
+    return Action::SoftDrop;
+  case sf::Keyboard::Space:
+    return Action::HardDrop;
+  case sf::Keyboard::S:
+    return Action::Hold;
+  default:
+    return Action::NumActions;
   }
+}
 
-  void unpause() {
-    assert(Paused);
-    TimeSpentPaused += Pause.restart();
-    Paused = false;
+void GameScreen::handleEvent(const sf::Event &Event) {
+  if (Event.type != sf::Event::KeyPressed || Playback) {
+    return;
   }
 
-  void togglePause() {
-    if (Paused) {
-      unpause();
-    } else {
-      pause();
+  if (Autoplaying) {
+    if (Event.key.code == sf::Keyboard::Escape) {
+      send(Command::Stop);
+      Active = false;
+      assert(ExitCallback);
+      ExitCallback();
+    } else if (Event.key.code == sf::Keyboard::P) {
+      send(Command::Input, Action::Pause);
     }
+    return;
   }
 
-};
+  Action A = keyAction(Event.key.code);
+  if (A != Action::NumActions) {
+    send(Command::Input, A);
+  }
+}
 
-static int randomIntBetween(int Low, int High) {
-  std::random_device Device;
-  std::mt19937 Generator(Device());
-  std::uniform_int_distribution<> Distribution(Low, High);
-  return Distribution(Generator);
+void GameScreen::fixSeed(uint64_t Seed) {
+  assert(!Thread.joinable());
+  HasFixedSeed = true;
+  FixedSeed = Seed;
+  Game.reset(Seed, Game.getPiecePolicy());
 }
 
-class Tetromino {
-public:
-  enum Kind {
-    I, O, T, J, L, S, Z,
-    NumKinds
-  };
-  typedef std::vector<std::vector<int>> Shape;
+void GameScreen::playReplay(ReplayReader &Reader, float Speed) {
+  assert(!Thread.joinable());
+  Playback.reset(new ReplayPlayer(Reader, Game));
+  PlaybackSpeed = Speed;
+}
 
-  Tetromino(Kind Type) : Type(Type), ShapeIndex(0) {}
+void GameScreen::skipToEndOfReplay() {
+  assert(!Thread.joinable());
+  Playback->runToEnd();
+  Snapshots.back() = Game;
+  Snapshots.publish();
+}
 
-  static Tetromino CreateRandom() {
-    int Kind = randomIntBetween(0, Tetromino::NumKinds - 1);
-    return Tetromino(static_cast<Tetromino::Kind>(Kind));
+// Runs on the render thread. The simulation itself runs on its own thread,
+// so a slow frame no longer holds up input; this only starts it and hands
+// finished games to whoever is waiting for them.
+void GameScreen::update() {
+  if (!Thread.joinable()) {
+    Thread = std::thread(&GameScreen::simulate, this);
   }
 
-  bool isValid() { return Type != NumKinds; }
-  Shape &getShape();
-  sf::Color getColor();
-  void rotateLeft();
-  void rotateRight();
-
-private:
-  Kind Type;
-  int ShapeIndex;
-};
-
-static std::map<Tetromino::Kind, sf::Color> COLORS = {
-  { Tetromino::I, sf::Color::White },
-  { Tetromino::O, sf::Color::Red },
-  { Tetromino::T, sf::Color::Yellow },
-  { Tetromino::J, sf::Color::Blue },
-  { Tetromino::L, sf::Color::Magenta },
-  { Tetromino::S, sf::Color::Cyan },
-  { Tetromino::Z, sf::Color::Green },
-};
+  if (!Active) {
+    ++Generation;
+    send(Command::Start);
+    Active = true;
+  }
 
-static std::map<Tetromino::Kind, std::vector<Tetromino::Shape>> SHAPES = {
-  {
-    Tetromino::I,
-    {
-      {
-        {0, 0, 0, 0},
-        {1, 1, 1, 1},
-        {0, 0, 0, 0},
-        {0, 0, 0, 0},
-      }, {
-        {0, 1, 0, 0},
-        {0, 1, 0, 0},
-        {0, 1, 0, 0},
-        {0, 1, 0, 0},
-      }
+  GameOver Over;
+  while (GameOvers.pop(Over)) {
+    if (Over.Generation != Generation || !Active) {
+      continue;
     }
-  },
-  {
-    Tetromino::O,
-    {
-      {
-        {0, 0, 0, 0},
-        {0, 1, 1, 0},
-        {0, 1, 1, 0},
-        {0, 0, 0, 0}
-      }
+    Active = false;
+    if (!Autoplaying) {
+      assert(EndCallback);
+      EndCallback(Over.Score);
+      // The callback switched to another mode; the next game waits for
+      // this screen's next update().
+      return;
     }
-  },
-  {
-    Tetromino::T,
+  }
+}
+
+void GameScreen::simulate() {
+  setTraceThreadName("simulation");
+  // The same 1 ms the simulation steps in, so that inputs are never
+  // waiting for more than one step.
+  const auto Period = std::chrono::microseconds(SimClock::StepTicks);
+  auto Next = std::chrono::steady_clock::now();
+
+  while (true) {
     {
-      {
-        {0, 0, 0, 0},
-        {0, 1, 0, 0},
-        {1, 1, 1, 0},
-        {0, 0, 0, 0}
-      }, {
-        {0, 0, 0, 0},
-        {0, 1, 0, 0},
-        {0, 1, 1, 0},
-        {0, 1, 0, 0}
-      }, {
-        {0, 0, 0, 0},
-        {0, 0, 0, 0},
-        {1, 1, 1, 0},
-        {0, 1, 0, 0}
-      }, {
-        {0, 0, 0, 0},
-        {0, 1, 0, 0},
-        {1, 1, 0, 0},
-        {0, 1, 0, 0}
+      TraceScope Scope("simulate");
+      Command C;
+      while (Commands.pop(C)) {
+        switch (C.Type) {
+        case Command::Input:
+          if (Running && !Playback) {
+            Sim.input(C.At > StartTime ? C.At - StartTime : 0, C.A);
+          }
+          break;
+        case Command::Start:
+          ++RunningGeneration;
+          start(C.At);
+          break;
+        case Command::Stop:
+          if (Running) {
+            endGame();
+          }
+          break;
+        case Command::SetAutoplayer:
+          AI = C.Player;
+          break;
+        case Command::Quit:
+          return;
+        }
       }
-    }
-  },
-  {
-    Tetromino::J,
-    {
-      {
-        {0, 0, 0, 0},
-        {1, 1, 1, 0},
-        {0, 0, 1, 0},
-        {0, 0, 0, 0}
-      }, {
-        {0, 1, 0, 0},
-        {0, 1, 0, 0},
-        {1, 1, 0, 0},
-        {0, 0, 0, 0}
-      }, {
-        {1, 0, 0, 0},
-        {1, 1, 1, 0},
-        {0, 0, 0, 0},
-        {0, 0, 0, 0}
-      }, {
-        {1, 1, 0, 0},
-        {1, 0, 0, 0},
-        {1, 0, 0, 0},
-        {0, 0, 0, 0}
+
+      if (Running) {
+        tick(steadyNow());
       }
+      Snapshots.back() = Game;
+      Snapshots.publish();
     }
-  },
-  {
-    Tetromino::L,
-    {
-      {
-        {0, 0, 0, 0},
-        {1, 1, 1, 0},
-        {1, 0, 0, 0},
-        {0, 0, 0, 0}
-      }, {
-        {0, 0, 0, 0},
-        {1, 1, 0, 0},
-        {0, 1, 0, 0},
-        {0, 1, 0, 0}
-      }, {
-        {0, 0, 0, 0},
-        {0, 0, 1, 0},
-        {1, 1, 1, 0},
-        {0, 0, 0, 0}
-      }, {
-        {1, 0, 0, 0},
-        {1, 0, 0, 0},
-        {1, 1, 0, 0},
-        {0, 0, 0, 0}
-      }
+
+    Next += Period;
+    auto Now = std::chrono::steady_clock::now();
+    if (Next < Now) {
+      // Fell behind; the SimClock catches up from real time anyway.
+      Next = Now;
     }
-  },
-  {
-    Tetromino::S,
-    {
-      {
-        {0, 0, 0, 0},
-        {0, 1, 1, 0},
-        {1, 1, 0, 0},
-        {0, 0, 0, 0},
-      }, {
-        {1, 0, 0, 0},
-        {1, 1, 0, 0},
-        {0, 1, 0, 0},
-        {0, 0, 0, 0},
-      }
+    std::this_thread::sleep_until(Next);
+  }
+}
+
+void GameScreen::tick(uint64_t Now) {
+  uint64_t Elapsed = Now - StartTime;
+  if (Playback) {
+    if (PlaybackSpeed > 0) {
+      Playback->advanceTo(Elapsed * double(PlaybackSpeed));
+    } else {
+      Playback->advanceTo(Playback->nextEventTime());
     }
-  },
-  {
-    Tetromino::Z,
-    {
-      {
-        {0, 0, 0, 0},
-        {1, 1, 0, 0},
-        {0, 1, 1, 0},
-        {0, 0, 0, 0},
-      }, {
-        {0, 0, 1, 0},
-        {0, 1, 1, 0},
-        {0, 1, 0, 0},
-        {0, 0, 0, 0},
-      }
+    return;
+  }
+
+  if (AI && !Game.isGameOver() && !Game.isPaused()) {
+    Sim.input(Elapsed, AI->nextAction(Game));
+  }
+
+  Sim.advanceTo(Elapsed, [&](Action A) { apply(A); });
+
+  if (Game.isGameOver() &&
+      Game.getTickElapsed() >= 2 * TetrisGame::TicksPerSecond) {
+    std::cerr << "Game over: score " << Game.getScore() << ", seed "
+              << Game.getSeed() << '\n';
+    GameOver Over = {RunningGeneration, Game.getScore()};
+    endGame();
+    GameOvers.push(Over);
+  }
+}
+
+void GameScreen::apply(Action A) {
+  Game.apply(A);
+  if (Recorder) {
+    Recorder->record(Game.getTime(), A);
+  }
+}
+
+// Starts the game, or resumes a replay, with real time counted from Now.
+void GameScreen::start(uint64_t Now) {
+  StartTime = Now;
+  Sim.reset();
+  Running = true;
+  if (RecordPath && !Playback) {
+    RecordFile.close();
+    if (RecordFile.open(RecordPath, std::ios::out | std::ios::binary |
+                                        std::ios::trunc)) {
+      Recorder.reset(new ReplayWriter(RecordFile, Game.getSeed(),
+                                      Game.getPiecePolicy()));
     }
   }
-};
+}
 
-Tetromino::Shape& Tetromino::getShape() {
-  return SHAPES[Type][ShapeIndex];
+void GameScreen::endGame() {
+  if (Recorder) {
+    Recorder->finish(Game.getTime());
+    Recorder.reset();
+    RecordFile.close();
+  }
+  if (HasFixedSeed) {
+    Game.reset(FixedSeed, Game.getPiecePolicy());
+  } else {
+    Game.reset();
+  }
+  Running = false;
 }
 
-sf::Color Tetromino::getColor() {
-  return COLORS[Type];
+// Calls Draw(X, Y, Outline, Fill) for every cell of the playfield, then for
+// the ghost and the current piece over them. State is a TetrisGame, or
+// anything else that can be drawn like one.
+template <typename GameState, typename Fn>
+static void forEachPlayfieldBlock(const GameState &State, Fn Draw) {
+  const Board &Grid = State.getBoard();
+  for (int i = 0; i < int(TetrisGame::Rows); ++i) {
+    for (int j = 0; j < int(TetrisGame::Cols); ++j) {
+      Draw(j, i, sf::Color::Black, COLORS[Grid.getCell(i, j)]);
+    }
+  }
+
+  Tetromino Current = State.getCurrent();
+  const Tetromino::Shape &Shape = Current.getShape();
+  Point Ghost = State.downDestination();
+  for (unsigned i = 0; i < 4; ++i) {
+    Draw(Ghost.x + Shape.CellX[i], Ghost.y + Shape.CellY[i], sf::Color::White,
+         sf::Color(0x99, 0x9d, 0xa0));
+  }
+  Point Pos = State.getCurrentPos();
+  for (unsigned i = 0; i < 4; ++i) {
+    Draw(Pos.x + Shape.CellX[i], Pos.y + Shape.CellY[i], sf::Color::Black,
+         COLORS[Current.getKind()]);
+  }
 }
 
-void Tetromino::rotateLeft() {
-  ShapeIndex = (ShapeIndex - 1) % SHAPES[Type].size();
+void GameScreen::addBlock(sf::Vector2f Pos, float Size, sf::Color Outline,
+                          sf::Color Fill) {
+  // Same geometry as an sf::RectangleShape with an outline thickness of 2:
+  // the outline extends outwards around the fill. It is drawn as four
+  // strips rather than one quad under the fill, as software renderers
+  // spend their time per pixel drawn.
+  auto addQuad = [&](float Left, float Top, float Width, float Height,
+                     sf::Color Color) {
+    assert(NumBlockVertices + 4 <= Blocks.getVertexCount());
+    sf::Vertex *Quad = &Blocks[NumBlockVertices];
+    Quad[0] = sf::Vertex(sf::Vector2f(Left, Top), Color);
+    Quad[1] = sf::Vertex(sf::Vector2f(Left + Width, Top), Color);
+    Quad[2] = sf::Vertex(sf::Vector2f(Left + Width, Top + Height), Color);
+    Quad[3] = sf::Vertex(sf::Vector2f(Left, Top + Height), Color);
+    NumBlockVertices += 4;
+  };
+  addQuad(Pos.x - 2, Pos.y - 2, Size + 4, 2, Outline);
+  addQuad(Pos.x - 2, Pos.y + Size, Size + 4, 2, Outline);
+  addQuad(Pos.x - 2, Pos.y, 2, Size, Outline);
+  addQuad(Pos.x + Size, Pos.y, 2, Size, Outline);
+  addQuad(Pos.x, Pos.y, Size, Size, Fill);
 }
 
-void Tetromino::rotateRight() {
-  ShapeIndex = (ShapeIndex + 1) % SHAPES[Type].size();
+void GameScreen::display(sf::RenderTarget &Window, sf::Font &Font) {
+  const unsigned Rows = TetrisGame::Rows;
+  const unsigned Cols = TetrisGame::Cols;
+  unsigned int Height = Window.getSize().y;
+  unsigned int Margin = 10;
+
+  unsigned int BlockSize = (Height - 2 * Margin) / Rows;
+  unsigned int FontSize = Height / 15;
+
+  sf::Vector2f GridSize(BlockSize * Cols, Height - 2 * Margin);
+  sf::Vector2f PreviewSize(BlockSize * 6, BlockSize * 4);
+
+  sf::Transform GridT;
+  GridT.translate(Margin, Margin);
+  sf::Transform NextT = GridT;
+  NextT.translate(GridSize.x + Margin * 2, 0);
+  sf::Transform SavedT = NextT;
+  SavedT.translate(PreviewSize.x + Margin * 2, 0);
+  sf::Transform StatsT = NextT;
+  StatsT.translate(0, Height / 2);
+
+  bool Resized = Chrome.draw(Window, [&](sf::RenderTexture &Target) {
+    auto drawBox = [&](sf::Vector2f Size, const sf::Transform &T) {
+      sf::RectangleShape Box(Size);
+      Box.setOutlineColor(sf::Color::White);
+      Box.setOutlineThickness(3);
+      Box.setFillColor(sf::Color::Black);
+      Target.draw(Box, T);
+      return Box;
+    };
+
+    auto drawLabel = [&](const char *String, float Y, const sf::Transform &T,
+                         const sf::RectangleShape *CenterIn) {
+      sf::Text Label(String, Font, FontSize);
+      Label.setPosition(0, Y);
+      if (CenterIn) {
+        centerTextHorizontally(Label, *CenterIn);
+      }
+      Target.draw(Label, T);
+    };
+
+    drawBox(GridSize, GridT);
+    sf::RectangleShape NextBox = drawBox(PreviewSize, NextT);
+    drawLabel("NEXT", PreviewSize.y + Margin * 2, NextT, &NextBox);
+    sf::RectangleShape SaveBox = drawBox(PreviewSize, SavedT);
+    drawLabel("SAVED", PreviewSize.y + Margin * 2, SavedT, &SaveBox);
+    drawLabel("Score", 0, StatsT, nullptr);
+    drawLabel("Lines", 2 * FontSize, StatsT, nullptr);
+    drawLabel("Level", 4 * FontSize, StatsT, nullptr);
+  });
+
+  if (Resized) {
+    auto layoutValue = [&](NumberText &Value, uint64_t &Shown, float Y) {
+      Value.setFont(Font, FontSize);
+      Value.setPosition(StatsT.transformPoint(0, Y));
+      Shown = UINT64_MAX;
+    };
+    layoutValue(ScoreValue, ShownScore, FontSize);
+    layoutValue(LinesValue, ShownLines, 3 * FontSize);
+    layoutValue(LevelValue, ShownLevel, 5 * FontSize);
+
+    PausedText = sf::Text("PAUSED", Font, Height / 4);
+    PausedText.setPosition(Window.getSize().x / 8, 3 * Height / 4);
+    PausedText.setFillColor(sf::Color::White);
+    PausedText.setOutlineColor(sf::Color::Black);
+    PausedText.setOutlineThickness(5);
+    PausedText.rotate(-45);
+  }
+
+  // Blocks are collected into one vertex array, in the order they would
+  // have been drawn, and submitted in a single draw call.
+  NumBlockVertices = 0;
+
+  auto drawBlock = [&](const sf::Transform &T, auto X, auto Y, auto Outline,
+                       auto Fill) {
+    addBlock(T.transformPoint(X * BlockSize, Y * BlockSize), BlockSize,
+             Outline, Fill);
+  };
+
+  auto drawShape = [&](const sf::Transform &T, auto &Shape, auto Pos,
+                       auto Outline, auto Fill) {
+    for (unsigned i = 0; i < 4; ++i) {
+      drawBlock(T, Pos.x + Shape.CellX[i], Pos.y + Shape.CellY[i], Outline,
+                Fill);
+    }
+  };
+
+  // The latest state the simulation published; it stays put while this
+  // frame is drawn.
+  const TetrisGame &State = Snapshots.read();
+  forEachPlayfieldBlock(State, [&](int X, int Y, sf::Color Outline,
+                                   sf::Color Fill) {
+    drawBlock(GridT, X, Y, Outline, Fill);
+  });
+
+  Tetromino Next = State.getNext();
+  drawShape(NextT, Next.getShape(), sf::Vector2i(1, 0), sf::Color::Black, COLORS[Next.getKind()]);
+
+  Tetromino Saved = State.getSaved();
+  if (Saved.isValid()) {
+    drawShape(SavedT, Saved.getShape(), sf::Vector2i(1, 0), sf::Color::Black, COLORS[Saved.getKind()]);
+  }
+
+  Window.draw(&Blocks[0], NumBlockVertices, sf::Quads);
+
+  auto updateValue = [](NumberText &Value, uint64_t &Shown, uint64_t Current) {
+    if (Shown != Current) {
+      Value.setNumber(Current);
+      Shown = Current;
+    }
+  };
+  updateValue(ScoreValue, ShownScore, State.getScore());
+  updateValue(LinesValue, ShownLines, State.getLines());
+  updateValue(LevelValue, ShownLevel, State.getLevel());
+
+  Window.draw(ScoreValue);
+  Window.draw(LinesValue);
+  Window.draw(LevelValue);
+
+  if (State.isPaused()) {
+    Window.draw(PausedText);
+  }
 }
 
-class TetrisGame : public Mode {
+// Shows many games at once, autoplayed or replayed, as a wall of small
+// boards. Every game is simulated on one thread, which also paints all the
+// boards, outlines and all, into a single image the size the wall appears
+// on screen. Drawing the wall is then one upload of that image and one
+// copy into the window, however many boards there are. The image is
+// painted bottom row first, as GL keeps framebuffers, so that the copy is
+// a framebuffer blit that software renderers do as a memcpy; drawing it as
+// a textured quad costs them several times as much per pixel.
+class SpectatorWall : public Mode {
 private:
-  uint64_t Score;
-  uint64_t Level;
-  uint64_t Lines;
-  Tetromino Current;
-  Tetromino Next;
-  Tetromino Saved;
-  sf::Vector2i CurrentPos;
-  std::vector<std::vector<sf::Color>> Grid;
-  PausableClock Tick;
-  bool Paused;
-  bool GameOver;
-  std::function<void(uint64_t)> EndCallback;
+  struct Match {
+    TetrisGame Game;
+    SimClock Sim;
+    uint64_t StartTime;
+    // Autoplayed games only; the AI moves at a watchable pace.
+    std::unique_ptr<Autoplayer> AI;
+    uint64_t NextInput;
+    // Replayed games only.
+    std::filebuf File;
+    std::unique_ptr<ReplayReader> Reader;
+    std::unique_ptr<ReplayPlayer> Playback;
+
+    explicit Match(PieceGenerator::Policy Pieces)
+        : Game(Pieces), Sim(Game), StartTime(0), NextInput(0) {}
+  };
 
-  bool currentPosIsValid();
-  void rotateLeft();
-  void rotateRight();
-  void moveLeft();
-  void moveRight();
-  void moveDown();
-  void reset();
+  static const uint64_t AIInputTicks = TetrisGame::TicksPerSecond / 20;
+  static const uint64_t PaintTicks = TetrisGame::TicksPerSecond / 120;
+
+  // The wall as painted, CellPixels square pixels to a cell, bottom row
+  // first.
+  struct WallImage {
+    unsigned CellPixels = 0;
+    // Counts paints, so that an image is only uploaded once.
+    uint64_t Serial = 0;
+    std::vector<sf::Uint8> Pixels;
+    // The colour each cell was last painted in this image, or zero, which
+    // no cell colour is, if it has not been yet.
+    std::vector<sf::Uint32> Cells;
+  };
 
-  void jumpDown();
-  sf::Vector2i downDestination();
-  void onPieceDown();
+  // Fixed once the simulation starts.
+  std::vector<std::unique_ptr<Match>> Matches;
+  // The boards are laid out in a grid this many boards wide, with a cell
+  // of border around each.
+  unsigned Columns;
+  // The size of the wall in cells.
+  sf::Vector2u GridSize;
+  sf::Vector2u WindowSize;
+
+  std::thread Thread;
+  std::atomic<bool> Stopping;
+  // Set by the render thread for the window's size, and zero until then.
+  std::atomic<unsigned> CellPixels;
+  TripleBuffer<WallImage> Images;
+  uint64_t Painted;
+
+  // Render thread state.
+  sf::Texture Image;
+  uint64_t Uploaded;
+  sf::Vector2u LaidOutFor;
+  // Framebuffers belong to a context, so Image is only blitted into the
+  // target ReadFramebuffer was made for; it goes with that context.
+  const sf::RenderTarget *BlitTarget;
+  GLuint ReadFramebuffer;
+  bool Blitting;
+  std::function<void()> ExitCallback;
+
+  void layOut();
+  void simulate();
+  void tick(Match &M, uint64_t Now);
+  void paint(WallImage &Out);
+  bool blit(sf::RenderTarget &Window, sf::Vector2i Position);
 
 public:
-  static const uint32_t Rows = 20;
-  static const uint32_t Cols = 10;
-  TetrisGame() : Score(0), Level(1), Lines(0),
-                 Current(Tetromino::CreateRandom()),
-                 Next(Tetromino::CreateRandom()),
-                 Saved(Tetromino::Kind::NumKinds),
-                 CurrentPos(3, 0),
-                 Grid(Rows, std::vector<sf::Color>(Cols, sf::Color::Black)),
-                 Paused(false), GameOver(false) {}
+  // Boards are laid out to best fill a window of WindowSize.
+  explicit SpectatorWall(sf::Vector2u WindowSize)
+      : Columns(1), WindowSize(WindowSize), Stopping(false), CellPixels(0),
+        Painted(0), Uploaded(0), BlitTarget(nullptr), ReadFramebuffer(0),
+        Blitting(true) {}
+  ~SpectatorWall();
+  void addAutoplayed(PieceGenerator::Policy Pieces,
+                     const Autoplayer::Options &Opts);
+  bool addReplay(const char *Path);
   void handleEvent(const sf::Event &Event);
   void update();
-  void display(sf::RenderWindow &Window, sf::Font &Font);
-  void setEndCallback(std::function<void(uint64_t)> Callback);
+  void display(sf::RenderTarget &Window, sf::Font &Font);
+  void setExitCallback(std::function<void()> Callback);
 };
 
-void TetrisGame::reset() {
-  Score = 0;
-  Level = 1;
-  Lines = 0;
-  Current = Tetromino::CreateRandom();
-  Next = Tetromino::CreateRandom();
-  Saved = Tetromino(Tetromino::Kind::NumKinds);
-  CurrentPos.x = 3;
-  CurrentPos.y = 0;
-  Grid = std::vector<std::vector<sf::Color>>(
-      Rows, std::vector<sf::Color>(Cols, sf::Color::Black));
-  Paused = false;
-  GameOver = false;
-}
-
-void TetrisGame::setEndCallback(std::function<void(uint64_t)> Callback) {
-  EndCallback = Callback;
+SpectatorWall::~SpectatorWall() {
+  if (Thread.joinable()) {
+    Stopping = true;
+    Thread.join();
+  }
 }
 
-bool TetrisGame::currentPosIsValid() {
-  Tetromino::Shape &Shape = Current.getShape();
+void SpectatorWall::addAutoplayed(PieceGenerator::Policy Pieces,
+                                  const Autoplayer::Options &Opts) {
+  assert(!Thread.joinable());
+  Matches.emplace_back(new Match(Pieces));
+  Matches.back()->AI.reset(new Autoplayer(Opts));
+}
 
-  // Left wall
-  if (CurrentPos.x < 0) {
-    for (auto &Row : Shape) {
-      if (Row[-CurrentPos.x - 1]) {
-        return false;
-      }
+bool SpectatorWall::addReplay(const char *Path) {
+  assert(!Thread.joinable());
+  std::unique_ptr<Match> M(new Match(PieceGenerator::Uniform));
+  if (!M->File.open(Path, std::ios::in | std::ios::binary)) {
+    return false;
+  }
+  M->Reader.reset(new ReplayReader(M->File));
+  if (!M->Reader->good()) {
+    return false;
+  }
+  M->Playback.reset(new ReplayPlayer(*M->Reader, M->Game));
+  Matches.push_back(std::move(M));
+  return true;
+}
+
+void SpectatorWall::setExitCallback(std::function<void()> Callback) {
+  ExitCallback = Callback;
+}
+
+void SpectatorWall::handleEvent(const sf::Event &Event) {
+  if (Event.type == sf::Event::KeyPressed &&
+      Event.key.code == sf::Keyboard::Escape) {
+    assert(ExitCallback);
+    ExitCallback();
+  }
+}
+
+// Picks the number of columns that makes the boards largest.
+void SpectatorWall::layOut() {
+  const unsigned BoardW = TetrisGame::Cols + 1, BoardH = TetrisGame::Rows + 1;
+  unsigned N = std::max<size_t>(Matches.size(), 1);
+  float Best = 0;
+  for (unsigned C = 1; C <= N; ++C) {
+    unsigned R = (N + C - 1) / C;
+    float Scale = std::min(WindowSize.x / float(C * BoardW + 1),
+                           WindowSize.y / float(R * BoardH + 1));
+    if (Scale > Best) {
+      Best = Scale;
+      Columns = C;
     }
   }
+  unsigned R = (N + Columns - 1) / Columns;
+  GridSize = sf::Vector2u(Columns * BoardW + 1, R * BoardH + 1);
+}
 
-  // Right wall
-  if (CurrentPos.x + Shape[0].size() - 1 > Cols - 1) {
-    for (auto &Row : Shape) {
-      if (Row[Cols - CurrentPos.x]) {
-        return false;
+void SpectatorWall::update() {
+  if (!Thread.joinable()) {
+    layOut();
+    Thread = std::thread(&SpectatorWall::simulate, this);
+  }
+}
+
+void SpectatorWall::simulate() {
+  setTraceThreadName("spectator simulation");
+  const auto Period = std::chrono::microseconds(SimClock::StepTicks);
+  auto Next = std::chrono::steady_clock::now();
+  uint64_t Start = steadyNow();
+  for (auto &M : Matches) {
+    M->StartTime = Start;
+  }
+  uint64_t NextPaint = Start;
+
+  // The window shows at most 60 frames a second, so painting every
+  // board after every step would mostly be thrown away.
+  auto paintIfDue = [&](uint64_t Now) {
+    if (Now >= NextPaint) {
+      TraceScope Scope("paint");
+      paint(Images.back());
+      Images.publish();
+      NextPaint = Now + PaintTicks;
+    }
+  };
+
+  while (!Stopping) {
+    uint64_t Now = steadyNow();
+    {
+      TraceScope Scope("simulate");
+      for (auto &M : Matches) {
+        tick(*M, Now);
+        // When many players choose a placement in the same step, the step
+        // can run longer than a frame; paint on the way rather than leave
+        // the wall standing still.
+        paintIfDue(steadyNow());
       }
     }
+
+    Next += Period;
+    auto Later = std::chrono::steady_clock::now();
+    if (Next < Later) {
+      Next = Later;
+    }
+    std::this_thread::sleep_until(Next);
+  }
+}
+
+void SpectatorWall::tick(Match &M, uint64_t Now) {
+  uint64_t Elapsed = Now - M.StartTime;
+  if (M.Playback) {
+    // A finished replay stays on its final state.
+    M.Playback->advanceTo(Elapsed);
+    return;
+  }
+
+  TetrisGame &Game = M.Game;
+  if (!Game.isGameOver() && Elapsed >= M.NextInput) {
+    M.Sim.input(Elapsed, M.AI->nextAction(Game));
+    M.NextInput = Elapsed + AIInputTicks;
+  }
+  M.Sim.advanceTo(Elapsed, [&](Action A) { Game.apply(A); });
+
+  if (Game.isGameOver() &&
+      Game.getTickElapsed() >= 2 * TetrisGame::TicksPerSecond) {
+    Game.reset();
+    M.Sim.reset();
+    M.StartTime = Now;
+    M.NextInput = 0;
+  }
+}
+
+void SpectatorWall::paint(WallImage &Out) {
+  unsigned Cell = CellPixels.load(std::memory_order_relaxed);
+  if (!Cell) {
+    return;
   }
+  const unsigned BoardW = TetrisGame::Cols + 1, BoardH = TetrisGame::Rows + 1;
+  const unsigned Width = GridSize.x * Cell, Height = GridSize.y * Cell;
+  // Fills a cell with Color, with its top and left edges outlined once
+  // there is room for outlines.
+  auto paintCell = [&](unsigned X, unsigned Y, sf::Color Color) {
+    sf::Uint32 &Last = Out.Cells[Y * GridSize.x + X];
+    if (Last == Color.toInteger()) {
+      return;
+    }
+    Last = Color.toInteger();
+    const sf::Uint8 Fill[4] = {Color.r, Color.g, Color.b, Color.a};
+    const sf::Uint8 Outline[4] = {0, 0, 0, 255};
+    unsigned Edge = Cell >= 4 ? 1 : 0;
+    for (unsigned Row = 0; Row < Cell; ++Row) {
+      sf::Uint8 *P =
+          &Out.Pixels[((Height - 1 - Y * Cell - Row) * Width + X * Cell) * 4];
+      unsigned Col = 0;
+      for (; Col < (Row < Edge ? Cell : Edge); ++Col, P += 4) {
+        std::memcpy(P, Outline, 4);
+      }
+      for (; Col < Cell; ++Col, P += 4) {
+        std::memcpy(P, Fill, 4);
+      }
+    }
+  };
 
-  // Ground
-  if (CurrentPos.y + Shape.size() - 1 > Rows - 1) {
-    for (unsigned i = 0; i < Shape[0].size(); ++i) {
-      if (Shape[Rows - CurrentPos.y][i]) {
-        return false;
+  // The borders never change, so they are only painted into each image
+  // when it first takes this size.
+  if (Out.CellPixels != Cell) {
+    Out.CellPixels = Cell;
+    Out.Pixels.resize(Width * Height * 4);
+    Out.Cells.assign(GridSize.x * GridSize.y, 0);
+    for (unsigned Y = 0; Y < GridSize.y; ++Y) {
+      for (unsigned X = 0; X < GridSize.x; ++X) {
+        if (X % BoardW == 0 || Y % BoardH == 0) {
+          paintCell(X, Y, sf::Color(0x40, 0x40, 0x40));
+        }
       }
     }
   }
 
-  // Other pieces
-  for (unsigned i = 0; i < Shape.size(); ++i) {
-    for (unsigned j = 0; j < Shape[i].size(); ++j) {
-      if (Shape[i][j] &&
-          Grid[CurrentPos.y + i][CurrentPos.x + j] != sf::Color::Black) {
-        return false;
+  // Each board's cells are worked out before any are painted, so that the
+  // cells under the piece and its ghost are not painted twice.
+  sf::Color Colors[TetrisGame::Rows][TetrisGame::Cols];
+  for (unsigned i = 0, E = Matches.size(); i != E; ++i) {
+    forEachPlayfieldBlock(Matches[i]->Game, [&](int X, int Y, sf::Color,
+                                                sf::Color Fill) {
+      if (0 <= X && X < int(TetrisGame::Cols) && 0 <= Y &&
+          Y < int(TetrisGame::Rows)) {
+        Colors[Y][X] = Fill;
+      }
+    });
+    unsigned Left = (i % Columns) * BoardW + 1;
+    unsigned Top = (i / Columns) * BoardH + 1;
+    for (unsigned Y = 0; Y < TetrisGame::Rows; ++Y) {
+      for (unsigned X = 0; X < TetrisGame::Cols; ++X) {
+        paintCell(Left + X, Top + Y, Colors[Y][X]);
       }
     }
   }
+  Out.Serial = ++Painted;
+}
 
-  return true;
+void SpectatorWall::display(sf::RenderTarget &Window, sf::Font &Font __unused) {
+  if (Window.getSize() != LaidOutFor) {
+    LaidOutFor = Window.getSize();
+    CellPixels = std::max(1u, std::min(LaidOutFor.x / GridSize.x,
+                                       LaidOutFor.y / GridSize.y));
+  }
+
+  const WallImage &Wall = Images.read();
+  if (Wall.Pixels.empty()) {
+    return;
+  }
+  sf::Vector2u Size(GridSize.x * Wall.CellPixels,
+                    GridSize.y * Wall.CellPixels);
+  if (Image.getSize() != Size) {
+    Image.create(Size.x, Size.y);
+    Uploaded = 0;
+  }
+  if (Uploaded != Wall.Serial) {
+    Image.update(Wall.Pixels.data());
+    Uploaded = Wall.Serial;
+  }
+
+  // Whole pixels, so that the image lands on the screen 1:1.
+  sf::Vector2i Position((LaidOutFor.x - std::min(LaidOutFor.x, Size.x)) / 2,
+                        (LaidOutFor.y - std::min(LaidOutFor.y, Size.y)) / 2);
+  if (Blitting && blit(Window, Position)) {
+    return;
+  }
+  sf::Sprite Sprite(Image, sf::IntRect(0, Size.y, Size.x, -int(Size.y)));
+  Sprite.setPosition(sf::Vector2f(Position));
+  Window.draw(Sprite, sf::BlendNone);
 }
 
-void TetrisGame::rotateLeft() {
-  Current.rotateLeft();
-  if (!currentPosIsValid()) {
-    Current.rotateRight();
+// Copies Image into Window with its top left corner at Position. Returns
+// false, and gives up blitting for good, if Window's context cannot.
+bool SpectatorWall::blit(sf::RenderTarget &Window, sf::Vector2i Position) {
+  if (!Window.setActive(true)) {
+    return false;
   }
+  if (!BlitTarget) {
+    BlitTarget = &Window;
+    // Only errors from here on count.
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    glGenFramebuffers(1, &ReadFramebuffer);
+  } else if (BlitTarget != &Window) {
+    return false;
+  }
+
+  GLint Read = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &Read);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, ReadFramebuffer);
+  // Image keeps its texture when resized, but is attached each frame
+  // anyway rather than rely on it.
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, Image.getNativeHandle(), 0);
+  sf::Vector2i Size(Image.getSize());
+  bool Done = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+              GL_FRAMEBUFFER_COMPLETE;
+  if (Done) {
+    // GL counts rows from the bottom of the target.
+    int Bottom = int(Window.getSize().y) - Position.y - Size.y;
+    glBlitFramebuffer(0, 0, Size.x, Size.y, Position.x, Bottom,
+                      Position.x + Size.x, Bottom + Size.y,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    Done = glGetError() == GL_NO_ERROR;
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, Read);
+  Blitting = Done;
+  return Done;
 }
 
-void TetrisGame::rotateRight() {
-  Current.rotateRight();
-  if (!currentPosIsValid()) {
-    Current.rotateLeft();
+// One player's side of a versus match on a server, with every player's
+// board side by side and this player's outlined. The server runs the
+// games; this screen only sends keys and draws what comes back.
+class VersusScreen : public Mode {
+private:
+  VersusClient Client;
+  bool Connected;
+  sf::VertexArray Blocks;
+  sf::Text Status;
+  const char *ShownMessage;
+  sf::Vector2u ShownSize;
+  std::function<void()> ExitCallback;
+
+public:
+  VersusScreen()
+      : Connected(false), Blocks(sf::Quads), ShownMessage(nullptr) {}
+  // Address is HOST:PORT.
+  bool connect(const std::string &Address);
+  void handleEvent(const sf::Event &Event);
+  void update();
+  void display(sf::RenderTarget &Window, sf::Font &Font);
+  void setExitCallback(std::function<void()> Callback);
+};
+
+bool VersusScreen::connect(const std::string &Address) {
+  size_t Colon = Address.rfind(':');
+  if (Colon == std::string::npos) {
+    return false;
   }
+  Connected = Client.connect(Address.substr(0, Colon),
+                             std::atoi(Address.c_str() + Colon + 1));
+  return Connected;
 }
 
+void VersusScreen::setExitCallback(std::function<void()> Callback) {
+  ExitCallback = Callback;
+}
 
-void TetrisGame::moveLeft() {
-  CurrentPos.x--;
-  if (!currentPosIsValid()) {
-    CurrentPos.x++;
+void VersusScreen::handleEvent(const sf::Event &Event) {
+  if (Event.type != sf::Event::KeyPressed) {
+    return;
+  }
+  if (Event.key.code == sf::Keyboard::Escape) {
+    assert(ExitCallback);
+    ExitCallback();
+    return;
+  }
+  Action A = keyAction(Event.key.code);
+  if (Connected && Client.isStarted() && A != Action::NumActions) {
+    Client.sendInput(A);
   }
 }
 
-void TetrisGame::moveRight() {
-  CurrentPos.x++;
-  if (!currentPosIsValid()) {
-    CurrentPos.x--;
+void VersusScreen::update() {
+  if (Connected) {
+    Connected = Client.poll();
   }
 }
 
-sf::Vector2i TetrisGame::downDestination() {
-  auto Y = CurrentPos.y;
-  while (currentPosIsValid()) {
-    CurrentPos.y++;
+void VersusScreen::display(sf::RenderTarget &Window, sf::Font &Font) {
+  const std::vector<VersusPlayerState> &Players = Client.getPlayers();
+  sf::Vector2u Size = Window.getSize();
+  unsigned Margin = 10;
+
+  // Boards in one row, as large as fits.
+  unsigned N = std::max<size_t>(Players.size(), 1);
+  float Block = std::min(
+      (Size.x - Margin * (N + 1)) / float(N * TetrisGame::Cols),
+      (Size.y - Margin * 2 - Size.y / 10) / float(TetrisGame::Rows));
+  Block = std::max(Block, 2.0f);
+
+  Blocks.clear();
+  auto addQuad = [&](float X, float Y, float W, float H, sf::Color Color) {
+    Blocks.append(sf::Vertex(sf::Vector2f(X, Y), Color));
+    Blocks.append(sf::Vertex(sf::Vector2f(X + W, Y), Color));
+    Blocks.append(sf::Vertex(sf::Vector2f(X + W, Y + H), Color));
+    Blocks.append(sf::Vertex(sf::Vector2f(X, Y + H), Color));
+  };
+  for (unsigned i = 0; i < Players.size(); ++i) {
+    float Left = Margin + i * (Block * TetrisGame::Cols + Margin);
+    float Top = Margin + Size.y / 10;
+    sf::Color Frame =
+        int(i) == Client.getPlayer() ? sf::Color::Yellow : sf::Color::White;
+    addQuad(Left - 3, Top - 3, Block * TetrisGame::Cols + 6,
+            Block * TetrisGame::Rows + 6, Frame);
+    forEachPlayfieldBlock(Players[i], [&](int X, int Y, sf::Color Outline,
+                                          sf::Color Fill) {
+      addQuad(Left + X * Block, Top + Y * Block, Block, Block, Outline);
+      addQuad(Left + X * Block + 1, Top + Y * Block + 1, Block - 2, Block - 2,
+              Fill);
+    });
+  }
+  Window.draw(Blocks);
+
+  const char *Message = "";
+  if (!Client.isStarted()) {
+    Message = Connected ? "WAITING FOR PLAYERS" : "NOT CONNECTED";
+  } else if (Client.isOver()) {
+    Message = Client.getWinner() == Client.getPlayer() ? "YOU WIN"
+                                                       : "GAME OVER";
+  } else if (!Connected) {
+    Message = "DISCONNECTED";
+  } else if (Players[Client.getPlayer()].isGameOver()) {
+    Message = "GAME OVER";
+  }
+  if (Message != ShownMessage || Size != ShownSize) {
+    ShownMessage = Message;
+    ShownSize = Size;
+    Status = sf::Text(Message, Font, Size.y / 15);
+    centerTextHorizontally(Status, Window);
   }
-  CurrentPos.y--;
-  auto Result = CurrentPos;
-  CurrentPos.y = Y;
-  return Result;
+  Window.draw(Status);
 }
 
-void TetrisGame::onPieceDown() {
-  Tetromino::Shape &Shape = Current.getShape();
-  for (unsigned i = 0; i < Shape.size(); ++i) {
-    for (unsigned j = 0; j < Shape[i].size(); ++j) {
-      if (Shape[i][j]) {
-        Grid[CurrentPos.y + i][CurrentPos.x + j] = Current.getColor();
-      }
-    }
+// Prints a summary of the time spent building and submitting each in-game
+// frame, in microseconds.
+static void reportFrameTimes(std::vector<sf::Int64> &Times) {
+  if (Times.empty()) {
+    return;
   }
-  CurrentPos.x = 3;
-  CurrentPos.y = 0;
-  Current = Next;
-  Next = Tetromino::CreateRandom();
-  Tick.restart();
+  std::sort(Times.begin(), Times.end());
+  sf::Int64 Total = 0;
+  for (sf::Int64 Time : Times) {
+    Total += Time;
+  }
+  std::cerr << "frames: " << Times.size()
+            << " mean: " << Total / (sf::Int64) Times.size()
+            << "us p50: " << Times[Times.size() / 2]
+            << "us p99: " << Times[Times.size() * 99 / 100]
+            << "us max: " << Times.back() << "us\n";
+}
+
+// Shows in the top right corner how many heap allocations the last frame
+// made, how many frames have allocated since it was last shown, and how
+// long the last frame took to build. The numbers are NumberTexts, so that
+// watching for allocations does not cause any.
+class DebugOverlay {
+private:
+  enum { FrameAllocations, AllocatingFrames, FrameMicros, NumValues };
 
-  int LinesCompleted = 0;
+  sf::Vector2u LaidOutFor;
+  sf::Text Labels;
+  NumberText Values[NumValues];
 
-  for (unsigned i = 0; i < Grid.size(); ++i) {
-    if (std::count(Grid[i].begin(), Grid[i].end(), sf::Color::Black) == 0) {
-      ++LinesCompleted;
-      for (int k = i, j = k - 1; j >= 0; --j, --k) {
-        std::copy(Grid[j].begin(), Grid[j].end(), Grid[k].begin());
+public:
+  void display(sf::RenderWindow &Window, sf::Font &Font,
+               uint64_t Allocations, uint64_t Allocating, uint64_t Micros) {
+    sf::Vector2u Size = Window.getSize();
+    if (Size != LaidOutFor) {
+      LaidOutFor = Size;
+      unsigned FontSize = std::max(Size.y / 40, 8u);
+      float Margin = FontSize / 2.0f;
+      Labels = sf::Text("allocs\nalloc frames\nframe us", Font, FontSize);
+      Labels.setFillColor(sf::Color::Yellow);
+      Labels.setPosition(Size.x - FontSize * 20.0f, Margin);
+      float LineSpacing = Font.getLineSpacing(FontSize);
+      for (unsigned i = 0; i < NumValues; ++i) {
+        Values[i].setFont(Font, FontSize);
+        Values[i].setPosition(Size.x - FontSize * 7.0f,
+                              Margin + LineSpacing * i);
       }
-      std::fill(Grid[0].begin(), Grid[0].end(), sf::Color::Black);
+    }
+    Values[FrameAllocations].setNumber(Allocations);
+    Values[AllocatingFrames].setNumber(Allocating);
+    Values[FrameMicros].setNumber(Micros);
+    Window.draw(Labels);
+    for (const NumberText &Value : Values) {
+      Window.draw(Value);
     }
   }
+};
 
-  Score += randomIntBetween(14, 19);
-  Lines += LinesCompleted;
-  Score += LinesCompleted * 100 * (LinesCompleted == 4 ? 2 : 1);
-  Level = 1 + Lines / 10;
+// Re-simulates each replay as fast as possible, without a window, and
+// prints the final state of every game followed by the throughput.
+static int verifyReplays(int Count, char **Paths) {
+  // One game and one file buffer serve every replay.
+  static char Buffer[1 << 16];
+  TetrisGame Game;
+  int Failures = 0;
+  sf::Clock Clock;
 
-  if (!currentPosIsValid()) {
-    GameOver = true;
-    return;
+  for (int i = 0; i < Count; ++i) {
+    std::filebuf File;
+    File.pubsetbuf(Buffer, sizeof(Buffer));
+    bool Good = File.open(Paths[i], std::ios::in | std::ios::binary);
+    if (Good) {
+      ReplayReader Reader(File);
+      ReplayPlayer Player(Reader, Game);
+      Player.runToEnd();
+      Good = Reader.good();
+    }
+    if (!Good) {
+      std::cout << Paths[i] << ": malformed\n";
+      ++Failures;
+      continue;
+    }
+    std::cout << Paths[i] << ": score " << Game.getScore() << " lines "
+              << Game.getLines() << " level " << Game.getLevel()
+              << (Game.isGameOver() ? "" : " (unfinished)") << '\n';
   }
-}
 
-void TetrisGame::moveDown() {
-  CurrentPos.y++;
-  if (!currentPosIsValid()) {
-    CurrentPos.y--;
-    onPieceDown();
-  }
+  float Seconds = Clock.getElapsedTime().asSeconds();
+  std::cerr << Count << " replays in " << Seconds << "s ("
+            << Count / Seconds << "/s)\n";
+  return Failures ? 1 : 0;
 }
 
-void TetrisGame::jumpDown() {
-  CurrentPos = downDestination();
-  onPieceDown();
-}
-
-void TetrisGame::handleEvent(const sf::Event &Event) {
-  if (GameOver) {
-    return;
-  }
+// Paints a game into Width x Height RGBA pixels on the CPU, so that games
+// can be captured without a display. The layout follows the game screen:
+// the playfield, the next and saved pieces beside it, and below them the
+// score, lines and level in a blocky 3x5 digit font.
+static void paintGame(const TetrisGame &Game, sf::Uint8 *Pixels,
+                      unsigned Width, unsigned Height) {
+  auto fillRect = [&](int Left, int Top, int W, int H, sf::Color Color) {
+    int Right = std::min(Left + W, int(Width));
+    int Bottom = std::min(Top + H, int(Height));
+    for (int Y = std::max(Top, 0); Y < Bottom; ++Y) {
+      for (int X = std::max(Left, 0); X < Right; ++X) {
+        sf::Uint8 *P = &Pixels[(size_t(Y) * Width + X) * 4];
+        P[0] = Color.r;
+        P[1] = Color.g;
+        P[2] = Color.b;
+        P[3] = Color.a;
+      }
+    }
+  };
+  fillRect(0, 0, Width, Height, sf::Color(0x40, 0x40, 0x40));
+
+  const int Rows = TetrisGame::Rows, Cols = TetrisGame::Cols;
+  int Block = std::max<int>(Height / (Rows + 2), 4);
+  int Inset = std::max(Block / 16, 1);
+  auto drawBlock = [&](int Left, int Top, int X, int Y, sf::Color Outline,
+                       sf::Color Fill) {
+    int PX = Left + X * Block, PY = Top + Y * Block;
+    fillRect(PX, PY, Block, Block, Outline);
+    fillRect(PX + Inset, PY + Inset, Block - 2 * Inset, Block - 2 * Inset,
+             Fill);
+  };
 
-  if (Event.type == sf::Event::KeyPressed) {
-    if (Event.key.code == sf::Keyboard::P) {
-      Tick.togglePause();
-      Paused = !Paused;
+  forEachPlayfieldBlock(Game, [&](int X, int Y, sf::Color Outline,
+                                  sf::Color Fill) {
+    if (0 <= X && X < Cols && 0 <= Y && Y < Rows) {
+      drawBlock(Block, Block, X, Y, Outline, Fill);
     }
+  });
 
-    if (Paused) {
+  int PreviewLeft = (Cols + 2) * Block;
+  auto drawPreview = [&](int Left, Tetromino Piece) {
+    fillRect(Left, Block, 6 * Block, 4 * Block, sf::Color::Black);
+    if (!Piece.isValid()) {
       return;
     }
+    const Tetromino::Shape &Shape = Piece.getShape();
+    for (unsigned i = 0; i < 4; ++i) {
+      drawBlock(Left, Block, 1 + Shape.CellX[i], Shape.CellY[i],
+                sf::Color::Black, COLORS[Piece.getKind()]);
+    }
+  };
+  drawPreview(PreviewLeft, Game.getNext());
+  drawPreview(PreviewLeft + 7 * Block, Game.getSaved());
 
-    switch (Event.key.code) {
-    case sf::Keyboard::Up:
-    case sf::Keyboard::X:
-      rotateRight();
-      break;
-    case sf::Keyboard::Z:
-      rotateLeft();
-      break;
-    case sf::Keyboard::Left:
-      moveLeft();
-      break;
-    case sf::Keyboard::Right:
-      moveRight();
-      break;
-    case sf::Keyboard::Down:
-      moveDown();
-      break;
-    case sf::Keyboard::Space:
-      jumpDown();
-      break;
-    case sf::Keyboard::S:
-      if (!Saved.isValid()) {
-        Saved = Current;
-        Current = Next;
-        Next = Tetromino::CreateRandom();
-      } else {
-        std::swap(Current, Saved);
-        if (!currentPosIsValid()) {
-          std::swap(Current, Saved);
+  // Each digit's rows, top first, three bits each.
+  static const uint16_t Digits[10] = {
+      075557, 026227, 071747, 071717, 055711,
+      074717, 074757, 071111, 075757, 075717,
+  };
+  int Pixel = std::max(Block / 4, 1);
+  auto drawNumber = [&](int Top, uint64_t Value) {
+    char Text[24];
+    int N = std::snprintf(Text, sizeof(Text), "%llu",
+                          (unsigned long long)Value);
+    for (int i = 0; i < N; ++i) {
+      uint16_t Bits = Digits[Text[i] - '0'];
+      for (int Y = 0; Y < 5; ++Y) {
+        for (int X = 0; X < 3; ++X) {
+          if (Bits >> ((4 - Y) * 3 + 2 - X) & 1) {
+            fillRect(PreviewLeft + (i * 4 + X) * Pixel, Top + Y * Pixel,
+                     Pixel, Pixel, sf::Color::White);
+          }
         }
       }
-      break;
-    default:
+    }
+  };
+  int StatsTop = 6 * Block;
+  drawNumber(StatsTop, Game.getScore());
+  drawNumber(StatsTop + 8 * Pixel, Game.getLines());
+  drawNumber(StatsTop + 16 * Pixel, Game.getLevel());
+}
+
+// Plays a replay back without a window, one frame every sixtieth of a
+// second of game time at the given speed, painting each frame for Capture.
+// Stops after MaxFrames, if not zero, or else once the replay ends.
+static int captureReplay(ReplayReader &Reader, float Speed,
+                         FrameCapture &Capture, uint64_t MaxFrames) {
+  TetrisGame Game;
+  ReplayPlayer Player(Reader, Game);
+  sf::Clock Clock;
+  for (uint64_t Frame = 0; !MaxFrames || Frame < MaxFrames; ++Frame) {
+    bool Playing = Player.advanceTo(Frame * double(Speed) *
+                                    TetrisGame::TicksPerSecond / 60);
+    if (sf::Uint8 *Pixels = Capture.beginFrame()) {
+      paintGame(Game, Pixels, Capture.getWidth(), Capture.getHeight());
+      Capture.submitFrame();
+    }
+    if (!Playing && !MaxFrames) {
       break;
     }
   }
+  bool Written = Capture.close();
+  float Seconds = Clock.getElapsedTime().asSeconds();
+  std::cerr << "captured " << Capture.getSubmitted() << " frames, dropped "
+            << Capture.getDropped() << ", in " << Seconds << "s\n";
+  if (!Written) {
+    std::cerr << "could not write every frame\n";
+  }
+  return Written && Reader.good() ? 0 : 1;
 }
 
-void TetrisGame::update() {
-  if (GameOver) {
-    if (Tick.getElapsedTime().asSeconds() >= 2) {
-      assert(EndCallback);
-      EndCallback(Score);
-      reset();
-    }
-  } else if (Tick.getElapsedTime().asSeconds() >= 1.0 / Level) {
-    moveDown();
-    Tick.restart();
+// Reads the frames drawn into a render texture back for a FrameCapture
+// without waiting for the GPU to draw them. Each frame is read into one of
+// two pixel buffer objects, which is only mapped a frame later, once the
+// copy has long finished, and copied from there straight into the
+// capture's buffer. Encoding is left to the capture's own threads.
+class FrameReadback {
+private:
+  GLuint Buffers[2];
+  // The buffer the next frame is read into; the other holds the frame
+  // before it, if Pending.
+  unsigned Next;
+  bool Pending;
+  unsigned Width;
+  unsigned Height;
+
+  void handOver(GLuint Buffer, FrameCapture &Capture);
+
+public:
+  FrameReadback() : Buffers{0, 0}, Next(0), Pending(false), Width(0),
+                    Height(0) {}
+
+  // Makes room for frames the size of Target. Returns false if its
+  // context cannot read into buffers.
+  bool create(sf::RenderTexture &Target);
+  // Starts reading the frame just drawn into Target, and hands the one
+  // before it over to Capture, unless it is to be dropped.
+  void capture(sf::RenderTexture &Target, FrameCapture &Capture);
+  // Hands the last frame over too, and frees the buffers.
+  void finish(sf::RenderTexture &Target, FrameCapture &Capture);
+  // Frames read but not yet handed over.
+  unsigned getPending() const { return Pending; }
+};
+
+bool FrameReadback::create(sf::RenderTexture &Target) {
+  if (!Target.setActive(true)) {
+    return false;
+  }
+  Width = Target.getSize().x;
+  Height = Target.getSize().y;
+  // Only errors from here on count.
+  while (glGetError() != GL_NO_ERROR) {
+  }
+  glGenBuffers(2, Buffers);
+  for (GLuint Buffer : Buffers) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, Buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(Width) * Height * 4,
+                 nullptr, GL_STREAM_READ);
   }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return glGetError() == GL_NO_ERROR;
 }
 
-static std::string formatInt(uint64_t Val) {
-  std::ostringstream Stream;
-  Stream << Val;
-  return Stream.str();
+void FrameReadback::capture(sf::RenderTexture &Target,
+                            FrameCapture &Capture) {
+  Target.setActive(true);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, Buffers[Next]);
+  glReadPixels(0, 0, Width, Height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  Next ^= 1;
+  if (Pending) {
+    handOver(Buffers[Next], Capture);
+  }
+  Pending = true;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 }
 
-void TetrisGame::display(sf::RenderWindow &Window, sf::Font &Font) {
-  unsigned int Height = Window.getSize().y;
-  unsigned int Margin = 10;
+void FrameReadback::finish(sf::RenderTexture &Target,
+                           FrameCapture &Capture) {
+  Target.setActive(true);
+  if (Pending) {
+    handOver(Buffers[Next ^ 1], Capture);
+    Pending = false;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glDeleteBuffers(2, Buffers);
+  Buffers[0] = Buffers[1] = 0;
+}
 
-  unsigned int BlockSize = (Height - 2 * Margin) / Rows;
+void FrameReadback::handOver(GLuint Buffer, FrameCapture &Capture) {
+  sf::Uint8 *Pixels = Capture.beginFrame();
+  if (!Pixels) {
+    return;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, Buffer);
+  const sf::Uint8 *Read = static_cast<const sf::Uint8 *>(
+      glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+  size_t Stride = size_t(Width) * 4;
+  if (Read) {
+    // GL counts rows from the bottom.
+    for (unsigned Row = 0; Row < Height; ++Row) {
+      std::memcpy(Pixels + Row * Stride, Read + (Height - 1 - Row) * Stride,
+                  Stride);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  } else {
+    std::memset(Pixels, 0, Stride * Height);
+  }
+  Capture.submitFrame();
+}
 
-  sf::Transform T;
-  T.translate(Margin, Margin);
-
-  sf::RectangleShape GridBox(sf::Vector2f(BlockSize * Cols, Height - 2 * Margin));
-  GridBox.setOutlineColor(sf::Color::White);
-  GridBox.setOutlineThickness(3);
-  GridBox.setFillColor(sf::Color::Black);
-  Window.draw(GridBox, T);
-
-  auto drawBlock = [&](auto X, auto Y, auto Outline, auto Fill) {
-    sf::RectangleShape Block(sf::Vector2f(BlockSize, BlockSize));
-    Block.setOutlineColor(Outline);
-    Block.setOutlineThickness(2);
-    Block.setFillColor(Fill);
-    Block.setPosition(X * BlockSize, Y * BlockSize);
-    Window.draw(Block, T);
-  };
+// Plays games with the Autoplayer on every core, without a window, and
+// prints how the results are distributed and how fast they came in.
+static int selfPlay(const SelfPlayOptions &Opts) {
+  SelfPlayResults Results = runSelfPlay(Opts);
+  if (Results.Games.empty()) {
+    return 0;
+  }
 
-  auto drawShape = [&](auto Shape, auto Pos, auto Outline, auto Fill) {
-    for (unsigned i = 0; i < Shape.size(); ++i) {
-      for (unsigned j = 0; j < Shape[i].size(); ++j) {
-        if (Shape[i][j]) {
-          drawBlock(Pos.x + j, Pos.y + i, Outline, Fill);
-        }
-      }
+  auto report = [&](const char *Name, uint64_t SelfPlayGame::*Field) {
+    std::vector<uint64_t> Values;
+    uint64_t Total = 0;
+    for (const SelfPlayGame &Game : Results.Games) {
+      Values.push_back(Game.*Field);
+      Total += Game.*Field;
     }
+    std::sort(Values.begin(), Values.end());
+    size_t N = Values.size();
+    std::cout << Name << ": mean " << Total / N << " min " << Values[0]
+              << " p10 " << Values[N / 10] << " p50 " << Values[N / 2]
+              << " p90 " << Values[N * 9 / 10] << " max " << Values.back()
+              << '\n';
   };
+  report("score", &SelfPlayGame::Score);
+  report("lines", &SelfPlayGame::Lines);
+  report("level", &SelfPlayGame::Level);
+  report("pieces", &SelfPlayGame::Pieces);
+
+  uint64_t Pieces = 0;
+  uint64_t ToppedOut = 0;
+  for (const SelfPlayGame &Game : Results.Games) {
+    Pieces += Game.Pieces;
+    ToppedOut += Game.ToppedOut;
+  }
+  std::cout << Results.Games.size() << " games (" << ToppedOut
+            << " topped out) on " << Results.Threads << " threads in "
+            << Results.Seconds << "s: "
+            << Results.Games.size() / Results.Seconds << " games/s, "
+            << Pieces / Results.Seconds << " pieces/s, " << Results.Steals
+            << " steals\n";
+  if (const TranspositionTable *Table = Opts.AI.Table) {
+    std::cout << "lookahead table: " << Table->getProbes() << " probes, "
+              << Table->getHitRate() * 100 << "% hits\n";
+  }
+  return 0;
+}
 
-  for (unsigned i = 0; i < Rows; ++i) {
-    for (unsigned j = 0; j < Cols; ++j) {
-      drawBlock(j, i, sf::Color::Black, Grid[i][j]);
-    }
+// Saves everything traced so far, replacing any earlier trace at Path.
+static void saveTrace(const char *Path) {
+  std::ofstream Stream(Path);
+  if (!writeChromeTrace(Stream)) {
+    std::cerr << "could not write trace to " << Path << '\n';
+    return;
   }
+  std::cerr << "trace written to " << Path << '\n';
+}
 
+// The default window size, shrunk to fit the screen, keeping its 4:3 shape.
+static sf::VideoMode startupVideoMode() {
+  unsigned Height = 1440;
+  unsigned ScreenHeight = sf::VideoMode::getDesktopMode().height;
+  if (ScreenHeight && Height > ScreenHeight * 9 / 10) {
+    Height = ScreenHeight * 9 / 10;
+  }
+  return sf::VideoMode(Height * 4 / 3, Height);
+}
 
-  Tetromino::Shape &Shape = Current.getShape();
-  drawShape(Shape, downDestination(), sf::Color::White, sf::Color(0x99, 0x9d, 0xa0));
-  drawShape(Shape, CurrentPos, sf::Color::Black, Current.getColor());
+// The font, its glyphs, the music and the high scores.
+static const unsigned LoadSteps = 4;
 
-  sf::RectangleShape NextBox(sf::Vector2f(BlockSize * 6, BlockSize * 4));
-  NextBox.setOutlineColor(sf::Color::White);
-  NextBox.setOutlineThickness(3);
-  NextBox.setFillColor(sf::Color::Black);
+// Loads everything the menu needs from disk, counting finished steps in
+// StepsLoaded. Glyphs are rendered ahead of time at the character sizes
+// the screens use for a window Height pixels tall, so that the first
+// frames that show text do not stall rasterising it.
+static bool loadAssets(sf::Font &Font, sf::Music &Music,
+                       HighScores &HighScores, unsigned Height,
+                       std::atomic<unsigned> &StepsLoaded) {
+  // Glyphs go into textures, which need a context on this thread.
+  sf::Context Context;
 
-  T.translate(GridBox.getSize().x + Margin * 2, 0);
+  if (!Font.loadFromFile(ASSETS_DIR "/joystix.ttf")) {
+    return false;
+  }
+  ++StepsLoaded;
 
-  unsigned int FontSize = Height / 15;
-  sf::Text NextLabel("NEXT", Font, FontSize);
-  NextLabel.setPosition(0, NextBox.getSize().y + Margin * 2);
-  centerTextHorizontally(NextLabel, NextBox);
+  for (unsigned Size : {Height / 4, Height / 8, Height / 15}) {
+    for (sf::Uint32 C = ' '; C <= '~'; ++C) {
+      Font.getGlyph(C, Size, false);
+    }
+  }
+  // The "PAUSED" banner is outlined, which is cached separately.
+  for (char C : std::string("PAUSED")) {
+    Font.getGlyph(C, Height / 4, false, 5);
+  }
+  ++StepsLoaded;
 
-  Window.draw(NextBox, T);
-  Window.draw(NextLabel, T);
+  if (!Music.openFromFile(ASSETS_DIR "/TetrisTheme.ogg")) {
+    return false;
+  }
+  ++StepsLoaded;
 
-  drawShape(Next.getShape(), sf::Vector2i(1, 0), sf::Color::Black, Next.getColor());
+  // FIXME(ibadawi): Where should the file be?
+  if (!HighScores.open("high_scores.dat", "high_scores.txt")) {
+    std::cerr << "could not open high_scores.dat; scores will not be "
+                 "saved\n";
+  }
+  ++StepsLoaded;
+  return true;
+}
 
-  sf::RectangleShape SaveBox(sf::Vector2f(BlockSize * 6, BlockSize * 4));
-  SaveBox.setOutlineColor(sf::Color::White);
-  SaveBox.setOutlineThickness(3);
-  SaveBox.setFillColor(sf::Color::Black);
+// Shown while assets load, so it cannot use the font: a T piece above a
+// progress bar.
+static void drawSplash(sf::RenderWindow &Window, float Progress) {
+  sf::Vector2f Size(Window.getSize());
+  float Block = Size.y / 20;
+  sf::Vector2f Origin(Size.x / 2 - Block * 1.5f, Size.y / 2 - Block * 2);
+
+  sf::RectangleShape Cell(sf::Vector2f(Block - 4, Block - 4));
+  Cell.setFillColor(COLORS[Tetromino::T]);
+  const Tetromino::Shape &Shape = Tetromino(Tetromino::T).getShape();
+  for (unsigned i = 0; i < 4; ++i) {
+    Cell.setPosition(Origin.x + Shape.CellX[i] * Block + 2,
+                     Origin.y + Shape.CellY[i] * Block + 2);
+    Window.draw(Cell);
+  }
 
-  T.translate(NextBox.getSize().x + Margin * 2, 0);
+  sf::Vector2f BarSize(Size.x / 3, Block / 3);
+  sf::RectangleShape Bar(BarSize);
+  Bar.setPosition(Size.x / 2 - BarSize.x / 2, Size.y / 2 + Block * 2);
+  Bar.setFillColor(sf::Color::Black);
+  Bar.setOutlineColor(sf::Color::White);
+  Bar.setOutlineThickness(2);
+  Window.draw(Bar);
+  Bar.setSize(sf::Vector2f(BarSize.x * Progress, BarSize.y));
+  Bar.setFillColor(sf::Color::White);
+  Window.draw(Bar);
+}
 
-  sf::Text SavedLabel("SAVED", Font, FontSize);
-  SavedLabel.setPosition(0, SaveBox.getSize().y + Margin * 2);
-  centerTextHorizontally(SavedLabel, SaveBox);
+int main(int argc, char **argv) {
+  uint64_t ProcessStart = steadyNow();
+  uint64_t TimeToFirstFrame = 0;
+  bool MeasureStartup = false;
+  bool ReportFrameTimes = false;
+  bool ShowOverlay = false;
+  uint64_t CheckAllocationFrames = 0;
+  const char *CapturePath = nullptr;
+  FrameCapture::Options CaptureOpts;
+  bool CapturePolicyGiven = false;
+  uint64_t CaptureFrames = 0;
+  unsigned CaptureWidth = 640, CaptureHeight = 480;
+  bool Headless = false;
+  PieceGenerator::Policy Pieces = PieceGenerator::Uniform;
+  const char *Seed = nullptr;
+  const char *RecordPath = nullptr;
+  const char *ReplayPath = nullptr;
+  Autoplayer::Options AIOptions;
+  std::unique_ptr<TranspositionTable> AITable;
+  float ReplaySpeed = 1;
+  bool SkipToEnd = false;
+  const char *TracePath = nullptr;
+  bool SelfPlay = false;
+  SelfPlayOptions SelfPlayOpts;
+  const char *ConnectTo = nullptr;
+  unsigned SpectateGames = 0;
+  std::vector<const char *> SpectateReplays;
+  for (int i = 1; i < argc; ++i) {
+    std::string Arg = argv[i];
+    if (Arg == "--frame-times") {
+      ReportFrameTimes = true;
+    } else if (Arg == "--debug-overlay") {
+      ShowOverlay = true;
+    } else if (Arg == "--check-allocations" && i + 1 < argc) {
+      CheckAllocationFrames = std::strtoull(argv[++i], nullptr, 10);
+    } else if (Arg == "--capture" && i + 1 < argc) {
+      CapturePath = argv[++i];
+      std::string Path = CapturePath;
+      if (Path.size() > 4 && Path.compare(Path.size() - 4, 4, ".y4m") == 0) {
+        CaptureOpts.Output = FrameCapture::Y4m;
+      }
+    } else if (Arg == "--capture-frames" && i + 1 < argc) {
+      CaptureFrames = std::strtoull(argv[++i], nullptr, 10);
+    } else if (Arg == "--capture-size" && i + 1 < argc) {
+      std::sscanf(argv[++i], "%ux%u", &CaptureWidth, &CaptureHeight);
+    } else if (Arg == "--capture-policy" && i + 1 < argc) {
+      std::string Policy = argv[++i];
+      CaptureOpts.WhenFull =
+          Policy == "wait" ? FrameCapture::Wait : FrameCapture::Drop;
+      CapturePolicyGiven = true;
+    } else if (Arg == "--capture-workers" && i + 1 < argc) {
+      CaptureOpts.Workers = std::strtoul(argv[++i], nullptr, 10);
+    } else if (Arg == "--headless") {
+      Headless = true;
+    } else if (Arg == "--measure-startup") {
+      MeasureStartup = true;
+    } else if (Arg == "--trace" && i + 1 < argc) {
+      TracePath = argv[++i];
+    } else if (Arg == "--seven-bag") {
+      Pieces = PieceGenerator::SevenBag;
+    } else if (Arg == "--seed" && i + 1 < argc) {
+      Seed = argv[++i];
+    } else if (Arg == "--record" && i + 1 < argc) {
+      RecordPath = argv[++i];
+    } else if (Arg == "--replay" && i + 1 < argc) {
+      ReplayPath = argv[++i];
+    } else if (Arg == "--speed" && i + 1 < argc) {
+      std::string Speed = argv[++i];
+      ReplaySpeed = Speed == "max" ? 0 : std::strtof(Speed.c_str(), nullptr);
+    } else if (Arg == "--final") {
+      SkipToEnd = true;
+    } else if (Arg == "--ai-weights" && i + 1 < argc) {
+      Autoplayer::Weights &W = AIOptions.Scoring;
+      std::sscanf(argv[++i], "%lf,%lf,%lf,%lf", &W.AggregateHeight, &W.Lines,
+                  &W.Holes, &W.Bumpiness);
+    } else if (Arg == "--ai-no-hold") {
+      AIOptions.UseHold = false;
+    } else if (Arg == "--ai-no-lookahead") {
+      AIOptions.Lookahead = false;
+    } else if (Arg == "--ai-hold-lookahead") {
+      AIOptions.LookaheadHold = true;
+    } else if (Arg == "--ai-table" && i + 1 < argc) {
+      // The largest power of two entries that fits in the megabytes given.
+      uint64_t Entries = std::strtoull(argv[++i], nullptr, 10) << 16;
+      unsigned Bits = 0;
+      while (Entries >> (Bits + 1)) {
+        ++Bits;
+      }
+      AITable.reset(Entries ? new TranspositionTable(Bits) : nullptr);
+      AIOptions.Table = AITable.get();
+    } else if (Arg == "--self-play" && i + 1 < argc) {
+      SelfPlay = true;
+      SelfPlayOpts.Games = std::strtoull(argv[++i], nullptr, 10);
+    } else if (Arg == "--threads" && i + 1 < argc) {
+      SelfPlayOpts.Threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (Arg == "--max-pieces" && i + 1 < argc) {
+      SelfPlayOpts.MaxPieces = std::strtoull(argv[++i], nullptr, 10);
+    } else if (Arg == "--board" && i + 1 < argc) {
+      std::sscanf(argv[++i], "%dx%d", &SelfPlayOpts.Rows, &SelfPlayOpts.Cols);
+    } else if (Arg == "--connect" && i + 1 < argc) {
+      ConnectTo = argv[++i];
+    } else if (Arg == "--spectate" && i + 1 < argc) {
+      SpectateGames = std::strtoul(argv[++i], nullptr, 10);
+    } else if (Arg == "--spectate-replays") {
+      SpectateReplays.assign(argv + i + 1, argv + argc);
+      break;
+    } else if (Arg == "--verify-replays") {
+      return verifyReplays(argc - i - 1, argv + i + 1);
+    }
+  }
 
-  Window.draw(SaveBox, T);
-  Window.draw(SavedLabel, T);
+  if (SelfPlay) {
+    if (!isBoardSize(SelfPlayOpts.Rows, SelfPlayOpts.Cols)) {
+      std::cerr << "board must be one of";
+#define TETRIS_PRINT_SIZE(Rows, Cols) std::cerr << ' ' << Rows << 'x' << Cols;
+      TETRIS_BOARD_SIZES(TETRIS_PRINT_SIZE)
+#undef TETRIS_PRINT_SIZE
+      std::cerr << '\n';
+      return 1;
+    }
+    SelfPlayOpts.FirstSeed =
+        Seed ? std::strtoull(Seed, nullptr, 10) : randomSeed();
+    SelfPlayOpts.Policy = Pieces;
+    SelfPlayOpts.AI = AIOptions;
+    return selfPlay(SelfPlayOpts);
+  }
 
-  if (Saved.isValid()) {
-    drawShape(Saved.getShape(), sf::Vector2i(1, 0), sf::Color::Black, Saved.getColor());
-  }
-
-  sf::Text ScoreLabel("Score", Font, FontSize);
-  sf::Text ScoreValue(formatInt(Score), Font, FontSize);
-  sf::Text LinesLabel("Lines", Font, FontSize);
-  sf::Text LinesValue(formatInt(Lines), Font, FontSize);
-  sf::Text LevelLabel("Level", Font, FontSize);
-  sf::Text LevelValue(formatInt(Level), Font, FontSize);
-
-  T.translate(-(NextBox.getSize().x + Margin * 2), Height / 2);
-
-  ScoreLabel.setPosition(0, 0);
-  ScoreValue.setPosition(0, FontSize);
-  LinesLabel.setPosition(0, 2 * FontSize);
-  LinesValue.setPosition(0, 3 * FontSize);
-  LevelLabel.setPosition(0, 4 * FontSize);
-  LevelValue.setPosition(0, 5 * FontSize);
-
-  Window.draw(ScoreLabel, T);
-  Window.draw(ScoreValue, T);
-  Window.draw(LinesLabel, T);
-  Window.draw(LinesValue, T);
-  Window.draw(LevelLabel, T);
-  Window.draw(LevelValue, T);
-
-  if (Paused) {
-    sf::Text PausedText("PAUSED", Font, Height / 4);
-    PausedText.setPosition(Window.getSize().x / 8, 3 * Height / 4);
-    PausedText.setFillColor(sf::Color::White);
-    PausedText.setOutlineColor(sf::Color::Black);
-    PausedText.setOutlineThickness(5);
-    PausedText.rotate(-45);
-    Window.draw(PausedText);
+  std::filebuf ReplayFile;
+  std::unique_ptr<ReplayReader> Replay;
+  if (ReplayPath) {
+    if (!ReplayFile.open(ReplayPath, std::ios::in | std::ios::binary)) {
+      return 1;
+    }
+    Replay.reset(new ReplayReader(ReplayFile));
+    if (!Replay->good()) {
+      return 1;
+    }
+  }
+
+  // Without a window, a replay is all there is to capture, and nothing is
+  // waiting on each frame, so by default none is dropped.
+  if (Headless) {
+    if (!Replay || !CapturePath || !CaptureWidth || !CaptureHeight) {
+      std::cerr << "--headless needs --replay FILE and --capture PATH\n";
+      return 1;
+    }
+    if (!CapturePolicyGiven) {
+      CaptureOpts.WhenFull = FrameCapture::Wait;
+    }
+    FrameCapture Capture;
+    if (!Capture.open(CapturePath, CaptureWidth, CaptureHeight,
+                      CaptureOpts)) {
+      std::cerr << "cannot write " << CapturePath << '\n';
+      return 1;
+    }
+    return captureReplay(*Replay, ReplaySpeed > 0 ? ReplaySpeed : 1, Capture,
+                         CaptureFrames);
   }
-}
 
-int main() {
-  std::srand(std::time(0));
-  sf::RenderWindow Window(sf::VideoMode(1920, 1440), "Tetris");
+  sf::RenderWindow Window(startupVideoMode(), "Tetris");
   Window.setFramerateLimit(60);
+
+  // Assets load in the background while a splash is shown, and nothing
+  // else touches them until loading is done.
   sf::Font Font;
-  if (!Font.loadFromFile(ASSETS_DIR "/joystix.ttf")) {
-    return 1;
-  }
   sf::Music Music;
-  if (!Music.openFromFile(ASSETS_DIR "/TetrisTheme.ogg")) {
+  HighScores HighScores;
+  std::atomic<unsigned> StepsLoaded(0);
+  unsigned Height = Window.getSize().y;
+  std::future<bool> Loading = std::async(std::launch::async, [&] {
+    return loadAssets(Font, Music, HighScores, Height, StepsLoaded);
+  });
+
+  bool Quit = false;
+  while (Loading.wait_for(std::chrono::seconds(0)) !=
+         std::future_status::ready) {
+    sf::Event Event;
+    while (Window.pollEvent(Event)) {
+      if (Event.type == sf::Event::Closed) {
+        Quit = true;
+      }
+    }
+    Window.clear();
+    drawSplash(Window, StepsLoaded / float(LoadSteps));
+    Window.display();
+    if (!TimeToFirstFrame) {
+      TimeToFirstFrame = steadyNow() - ProcessStart;
+    }
+  }
+  if (!Loading.get()) {
     return 1;
   }
   Music.setLoop(true);
   Music.play();
 
-  HighScores HighScores;
-  // FIXME(ibadawi): Where should the file be?
-  HighScores.loadFromFile("high_scores.txt");
-
   Menu MainMenu;
-  TetrisGame Game;
+  // Outlives Game, whose simulation thread may be using it.
+  Autoplayer AI(AIOptions);
+  GameScreen Game(Pieces);
+  if (Seed) {
+    Game.fixSeed(std::strtoull(Seed, nullptr, 10));
+  }
+  if (RecordPath) {
+    Game.recordTo(RecordPath);
+  }
+
+  SpectatorWall Wall(Window.getSize());
+  for (unsigned i = 0; i < SpectateGames; ++i) {
+    Wall.addAutoplayed(Pieces, AIOptions);
+  }
+  for (const char *Path : SpectateReplays) {
+    if (!Wall.addReplay(Path)) {
+      std::cerr << Path << ": malformed\n";
+      return 1;
+    }
+  }
+  Wall.setExitCallback([&] { Quit = true; });
+
+  VersusScreen Versus;
+  Versus.setExitCallback([&] { Quit = true; });
 
   Mode *Mode = &MainMenu;
+  if (SpectateGames || !SpectateReplays.empty()) {
+    Mode = &Wall;
+  }
+  if (ConnectTo) {
+    if (!Versus.connect(ConnectTo)) {
+      std::cerr << "cannot connect to " << ConnectTo << '\n';
+      return 1;
+    }
+    Mode = &Versus;
+  }
+  if (Replay) {
+    Game.playReplay(*Replay, ReplaySpeed);
+    if (SkipToEnd) {
+      Game.skipToEndOfReplay();
+    }
+    Mode = &Game;
+  }
+  if (CheckAllocationFrames) {
+    // The AI plays, and the overlay is up, so that checking covers both.
+    if (!Replay) {
+      Game.setAutoplayer(&AI);
+    }
+    Mode = &Game;
+    ShowOverlay = true;
+  }
 
-  bool Quit = false;
 
-  MainMenu.addMenuItem("Play", [&] { Mode = &Game; });
+  MainMenu.addMenuItem("Play", [&] {
+    Game.setAutoplayer(nullptr);
+    Mode = &Game;
+  });
+  MainMenu.addMenuItem("AI Player", [&] {
+    Game.setAutoplayer(&AI);
+    Mode = &Game;
+  });
   MainMenu.addMenuItem("High Scores", [&] { Mode = &HighScores; });
   MainMenu.addMenuItem("Quit Game", [&] { Quit = true; });
 
   HighScores.setEndCallback([&] { Mode = &MainMenu; });
+  Game.setExitCallback([&] { Mode = &MainMenu; });
 
   Game.setEndCallback([&](uint64_t Score) {
-    if (HighScores.isHighScore(Score)) {
+    std::cerr << "Rank " << HighScores.recordScore(Score) << '\n';
+    if (HighScores.needsName()) {
       Mode = &HighScores;
-      HighScores.recordNewHighScore(Score);
     } else {
       Mode = &MainMenu;
     }
   });
 
+  sf::Clock FrameClock;
+  std::vector<sf::Int64> FrameTimes;
+  if (ReportFrameTimes) {
+    // Enough for a long game, so that recording does not allocate in one.
+    FrameTimes.reserve(1 << 18);
+  }
+
+  // While capturing, frames are drawn into CaptureTarget, which is then
+  // both shown in the window and handed to the encoders.
+  FrameCapture Capture;
+  sf::RenderTexture CaptureTarget;
+  FrameReadback Readback;
+  if (CapturePath) {
+    sf::Vector2u Size = Window.getSize();
+    if (!CaptureTarget.create(Size.x, Size.y) ||
+        !Readback.create(CaptureTarget) ||
+        !Capture.open(CapturePath, Size.x, Size.y, CaptureOpts)) {
+      std::cerr << "cannot capture to " << CapturePath << '\n';
+      return 1;
+    }
+  }
+
+  // Heap allocations made by the last frame, on any thread, and how many
+  // frames have made any since the overlay was last shown.
+  DebugOverlay Overlay;
+  uint64_t FrameAllocations = 0;
+  uint64_t AllocatingFrames = 0;
+  sf::Int64 FrameMicros = 0;
+  // Frames past the first few, which load glyphs and start threads, that
+  // the allocation check has seen, and how many of them allocated.
+  const uint64_t CheckWarmupFrames = 120;
+  uint64_t Frames = 0;
+  uint64_t CheckedFrames = 0;
+  uint64_t FailedFrames = 0;
+  uint64_t MostAllocations = 0;
+
+  if (TracePath) {
+    setTraceThreadName("main");
+    enableTracing(true);
+  }
 
   while (!Quit && Window.isOpen()) {
-    sf::Event Event;
-    while (Window.pollEvent(Event)) {
-      if (Event.type == sf::Event::Closed) {
-        Quit = true;
+    uint64_t FrameStartAllocations = allocationCount();
+    TraceScope FrameScope("frame");
+    {
+      TraceScope Scope("events");
+      sf::Event Event;
+      while (Window.pollEvent(Event)) {
+        if (Event.type == sf::Event::Closed) {
+          Quit = true;
+        }
+        if (Event.type == sf::Event::Resized) {
+          Window.setView(sf::View(sf::FloatRect(
+              0, 0, Event.size.width, Event.size.height)));
+        }
+        if (Event.type == sf::Event::KeyPressed) {
+          if (Event.key.code == sf::Keyboard::M && Mode != &HighScores) {
+            if (Music.getStatus() != sf::SoundSource::Playing) {
+              Music.play();
+            } else {
+              Music.pause();
+            }
+          }
+          if (Event.key.code == sf::Keyboard::F12 && TracePath) {
+            saveTrace(TracePath);
+          }
+          if (Event.key.code == sf::Keyboard::F3) {
+            ShowOverlay = !ShowOverlay;
+            AllocatingFrames = 0;
+          }
+        }
+        Mode->handleEvent(Event);
+      }
+    }
+
+    {
+      TraceScope Scope("update");
+      Mode->update();
+    }
+    FrameClock.restart();
+    {
+      TraceScope Scope("draw");
+      if (Capture.isOpen()) {
+        CaptureTarget.clear();
+        Mode->display(CaptureTarget, Font);
+        CaptureTarget.display();
+        Readback.capture(CaptureTarget, Capture);
+        Window.clear();
+        Window.draw(sf::Sprite(CaptureTarget.getTexture()));
+        uint64_t Captured = Capture.getSubmitted() + Capture.getDropped() +
+                            Readback.getPending();
+        if (CaptureFrames && Captured >= CaptureFrames) {
+          Quit = true;
+        }
+      } else {
+        Window.clear();
+        Mode->display(Window, Font);
       }
-      if (Event.type == sf::Event::Resized) {
-        Window.setView(sf::View(sf::FloatRect(
-            0, 0, Event.size.width, Event.size.height)));
+      if (ShowOverlay) {
+        Overlay.display(Window, Font, FrameAllocations, AllocatingFrames,
+                        FrameMicros);
       }
-      if (Event.type == sf::Event::KeyPressed) {
-        if (Event.key.code == sf::Keyboard::M && Mode != &HighScores) {
-          if (Music.getStatus() != sf::SoundSource::Playing) {
-            Music.play();
-          } else {
-            Music.pause();
-          }
+    }
+    FrameMicros = FrameClock.getElapsedTime().asMicroseconds();
+    if (ReportFrameTimes && (Mode == &Game || Mode == &Wall)) {
+      FrameTimes.push_back(FrameMicros);
+    }
+    {
+      TraceScope Scope("present");
+      Window.display();
+    }
+
+    FrameAllocations = allocationCount() - FrameStartAllocations;
+    if (FrameAllocations) {
+      ++AllocatingFrames;
+    }
+    if (CheckAllocationFrames) {
+      if (++Frames > CheckWarmupFrames) {
+        ++CheckedFrames;
+        if (FrameAllocations) {
+          ++FailedFrames;
+          MostAllocations = std::max(MostAllocations, FrameAllocations);
         }
+        Quit = Quit || CheckedFrames == CheckAllocationFrames;
       }
-      Mode->handleEvent(Event);
     }
 
-    Mode->update();
-    Window.clear();
-    Mode->display(Window, Font);
-    Window.display();
+    if (!TimeToFirstFrame) {
+      TimeToFirstFrame = steadyNow() - ProcessStart;
+    }
+    if (MeasureStartup) {
+      // The first frame after loading is the first one that takes input.
+      std::cerr << "first frame: " << TimeToFirstFrame / 1000.0
+                << "ms interactive: "
+                << (steadyNow() - ProcessStart) / 1000.0 << "ms\n";
+      Quit = true;
+    }
   }
 
-  HighScores.saveToFile("high_scores.txt");
+  reportFrameTimes(FrameTimes);
+  int Status = FailedFrames ? 1 : 0;
+  if (Capture.isOpen()) {
+    Readback.finish(CaptureTarget, Capture);
+    uint64_t Submitted = Capture.getSubmitted();
+    if (!Capture.close()) {
+      std::cerr << "could not write every captured frame\n";
+      Status = 1;
+    }
+    std::cerr << "captured " << Submitted << " frames, dropped "
+              << Capture.getDropped() << '\n';
+  }
+  if (CheckAllocationFrames) {
+    std::cerr << "allocating frames: " << FailedFrames << " of "
+              << CheckedFrames << ", most allocations in one: "
+              << MostAllocations << '\n';
+  }
+  if (TracePath) {
+    saveTrace(TracePath);
+  }
+
+  HighScores.close();
   Window.close();
 
-  return 0;
+  return Status;
 }
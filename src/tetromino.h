@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+// One rotation of a tetromino within its 4x4 box.
+struct TetrominoShape {
+  static const int8_t NoBottom = -64;
+
+  // Row I of the box, with column J at bit J.
+  uint16_t Rows[4];
+  // Bounding box of the filled cells, inclusive.
+  int8_t MinX, MaxX, MinY, MaxY;
+  // Box coordinates of the four filled cells.
+  int8_t CellX[4], CellY[4];
+  // Lowest filled row of each box column. Empty columns hold NoBottom,
+  // far enough above the box that they never limit a drop.
+  int8_t Bottom[4];
+};
+
+// Builds a shape from a 4x4 picture in row-major order, '#' marking the
+// filled cells.
+static constexpr TetrominoShape makeShape(const char (&Picture)[17]) {
+  TetrominoShape Shape{};
+  Shape.MinX = Shape.MinY = 3;
+  for (int8_t &Bottom : Shape.Bottom) {
+    Bottom = TetrominoShape::NoBottom;
+  }
+  int Cell = 0;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      if (Picture[i * 4 + j] != '#') {
+        continue;
+      }
+      Shape.Rows[i] |= 1 << j;
+      Shape.MinX = j < Shape.MinX ? j : Shape.MinX;
+      Shape.MaxX = j > Shape.MaxX ? j : Shape.MaxX;
+      Shape.MinY = i < Shape.MinY ? i : Shape.MinY;
+      Shape.MaxY = i > Shape.MaxY ? i : Shape.MaxY;
+      Shape.CellX[Cell] = j;
+      Shape.CellY[Cell] = i;
+      Shape.Bottom[j] = i;
+      ++Cell;
+    }
+  }
+  return Shape;
+}
+
+class Tetromino {
+public:
+  enum Kind : uint8_t {
+    I, O, T, J, L, S, Z,
+    NumKinds
+  };
+  typedef TetrominoShape Shape;
+
+  Tetromino(Kind Type, uint8_t Rotation = 0)
+      : Type(Type), ShapeIndex(Rotation) {}
+
+  bool isValid() const { return Type != NumKinds; }
+  Kind getKind() const { return Type; }
+  uint8_t getRotation() const { return ShapeIndex; }
+  inline uint8_t getNumRotations() const;
+  inline const Shape &getShape() const;
+  inline void rotateLeft();
+  inline void rotateRight();
+
+private:
+  Kind Type;
+  uint8_t ShapeIndex;
+};
+
+static_assert(std::is_trivially_copyable<Tetromino>::value,
+              "Tetromino is copied around freely by value");
+
+static constexpr uint8_t NUM_ROTATIONS[Tetromino::NumKinds] = {
+  2, 1, 4, 4, 4, 2, 2
+};
+
+static constexpr TetrominoShape SHAPES[Tetromino::NumKinds][4] = {
+  { // I
+    makeShape("...."
+              "####"
+              "...."
+              "...."),
+    makeShape(".#.."
+              ".#.."
+              ".#.."
+              ".#.."),
+  },
+  { // O
+    makeShape("...."
+              ".##."
+              ".##."
+              "...."),
+  },
+  { // T
+    makeShape("...."
+              ".#.."
+              "###."
+              "...."),
+    makeShape("...."
+              ".#.."
+              ".##."
+              ".#.."),
+    makeShape("...."
+              "...."
+              "###."
+              ".#.."),
+    makeShape("...."
+              ".#.."
+              "##.."
+              ".#.."),
+  },
+  { // J
+    makeShape("...."
+              "###."
+              "..#."
+              "...."),
+    makeShape(".#.."
+              ".#.."
+              "##.."
+              "...."),
+    makeShape("#..."
+              "###."
+              "...."
+              "...."),
+    makeShape("##.."
+              "#..."
+              "#..."
+              "...."),
+  },
+  { // L
+    makeShape("...."
+              "###."
+              "#..."
+              "...."),
+    makeShape("...."
+              "##.."
+              ".#.."
+              ".#.."),
+    makeShape("...."
+              "..#."
+              "###."
+              "...."),
+    makeShape("#..."
+              "#..."
+              "##.."
+              "...."),
+  },
+  { // S
+    makeShape("...."
+              ".##."
+              "##.."
+              "...."),
+    makeShape("#..."
+              "##.."
+              ".#.."
+              "...."),
+  },
+  { // Z
+    makeShape("...."
+              "##.."
+              ".##."
+              "...."),
+    makeShape("..#."
+              ".##."
+              ".#.."
+              "...."),
+  },
+};
+
+static_assert(SHAPES[Tetromino::I][0].Rows[1] == 0xF &&
+              SHAPES[Tetromino::T][2].MaxY == 3 &&
+              SHAPES[Tetromino::I][1].Bottom[1] == 3,
+              "shape tables are built at compile time");
+
+uint8_t Tetromino::getNumRotations() const {
+  return NUM_ROTATIONS[Type];
+}
+
+const Tetromino::Shape &Tetromino::getShape() const {
+  return SHAPES[Type][ShapeIndex];
+}
+
+void Tetromino::rotateLeft() {
+  ShapeIndex = ShapeIndex == 0 ? NUM_ROTATIONS[Type] - 1 : ShapeIndex - 1;
+}
+
+void Tetromino::rotateRight() {
+  ShapeIndex = ShapeIndex + 1 == NUM_ROTATIONS[Type] ? 0 : ShapeIndex + 1;
+}
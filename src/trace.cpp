@@ -0,0 +1,185 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> TracingEnabled(false);
+
+namespace {
+
+struct Event {
+  const char *Name;
+  uint64_t Start;
+  // Zero for instants.
+  uint64_t Duration;
+  int64_t Value;
+  bool Instant;
+};
+
+// One event in a ring buffer, which writeChromeTrace() may read while the
+// owning thread rewrites it. Every field is atomic, so neither side races,
+// and Seq tells a reader whether what it read is one whole event: it is
+// 2 * (N + 1) once event N is in the slot, and odd while one is written.
+// Fields are stored with release and loaded with acquire rather than
+// fenced, which costs nothing more on x86 and which ThreadSanitizer
+// understands: a reader that sees any field of a newer event then sees
+// Seq odd or past N.
+struct Slot {
+  std::atomic<uint64_t> Seq;
+  std::atomic<const char *> Name;
+  std::atomic<uint64_t> Start;
+  std::atomic<uint64_t> Duration;
+  std::atomic<int64_t> Value;
+  std::atomic<bool> Instant;
+
+  void write(uint64_t N, const Event &E) {
+    Seq.store(2 * N + 1, std::memory_order_relaxed);
+    Name.store(E.Name, std::memory_order_release);
+    Start.store(E.Start, std::memory_order_release);
+    Duration.store(E.Duration, std::memory_order_release);
+    Value.store(E.Value, std::memory_order_release);
+    Instant.store(E.Instant, std::memory_order_release);
+    Seq.store(2 * (N + 1), std::memory_order_release);
+  }
+
+  // Returns false if the slot no longer, or does not yet, hold event N in
+  // full.
+  bool read(uint64_t N, Event &E) const {
+    if (Seq.load(std::memory_order_acquire) != 2 * (N + 1)) {
+      return false;
+    }
+    E.Name = Name.load(std::memory_order_acquire);
+    E.Start = Start.load(std::memory_order_acquire);
+    E.Duration = Duration.load(std::memory_order_acquire);
+    E.Value = Value.load(std::memory_order_acquire);
+    E.Instant = Instant.load(std::memory_order_acquire);
+    return Seq.load(std::memory_order_relaxed) == 2 * (N + 1);
+  }
+};
+
+struct ThreadBuffer {
+  // A power of two; about 1.5 MB per thread that records anything.
+  static const uint64_t Capacity = 1 << 15;
+
+  // Value-initialized with the buffer, so every Seq starts out at zero.
+  Slot Events[Capacity];
+  // Events ever written; the newest is at (Count - 1) % Capacity. Only the
+  // owning thread writes it.
+  std::atomic<uint64_t> Count;
+  std::atomic<const char *> Name;
+  unsigned Id;
+
+  void push(const Event &E) {
+    uint64_t N = Count.load(std::memory_order_relaxed);
+    Events[N % Capacity].write(N, E);
+    Count.store(N + 1, std::memory_order_release);
+  }
+};
+
+// Every buffer ever created. Buffers outlive their threads so that their
+// events still make it into the trace.
+std::mutex BuffersLock;
+std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+
+ThreadBuffer &threadBuffer() {
+  thread_local ThreadBuffer *Buffer = nullptr;
+  if (!Buffer) {
+    std::lock_guard<std::mutex> Guard(BuffersLock);
+    Buffers.emplace_back(new ThreadBuffer());
+    Buffer = Buffers.back().get();
+    Buffer->Count.store(0, std::memory_order_relaxed);
+    Buffer->Name.store(nullptr, std::memory_order_relaxed);
+    Buffer->Id = Buffers.size();
+  }
+  return *Buffer;
+}
+
+// Prints nanoseconds as microseconds, which is what the format expects,
+// without losing precision in long traces.
+void printMicros(std::ostream &Out, uint64_t Ns) {
+  char Fraction[4] = {char('0' + Ns / 100 % 10), char('0' + Ns / 10 % 10),
+                      char('0' + Ns % 10), 0};
+  Out << Ns / 1000 << '.' << Fraction;
+}
+
+} // end anonymous namespace
+
+void enableTracing(bool Enable) {
+  TracingEnabled.store(Enable, std::memory_order_relaxed);
+}
+
+uint64_t traceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void traceSpan(const char *Name, uint64_t Start, uint64_t End) {
+  threadBuffer().push({Name, Start, End - Start, 0, false});
+}
+
+void traceInstant(const char *Name, int64_t Value) {
+  if (tracingEnabled()) {
+    threadBuffer().push({Name, traceNow(), 0, Value, true});
+  }
+}
+
+void setTraceThreadName(const char *Name) {
+  threadBuffer().Name.store(Name, std::memory_order_relaxed);
+}
+
+bool writeChromeTrace(std::ostream &Out) {
+  std::lock_guard<std::mutex> Guard(BuffersLock);
+  const uint64_t Capacity = ThreadBuffer::Capacity;
+
+  // Timestamps are printed relative to the earliest event.
+  std::vector<std::vector<Event>> Copies;
+  uint64_t Origin = UINT64_MAX;
+  for (auto &Buffer : Buffers) {
+    uint64_t End = Buffer->Count.load(std::memory_order_acquire);
+    uint64_t Begin = End > Capacity ? End - Capacity : 0;
+    // Events the thread overwrites while they are copied are left out.
+    std::vector<Event> Copy;
+    Event E;
+    for (uint64_t i = Begin; i < End; ++i) {
+      if (Buffer->Events[i % Capacity].read(i, E)) {
+        Copy.push_back(E);
+      }
+    }
+    for (const Event &E : Copy) {
+      Origin = std::min(Origin, E.Start);
+    }
+    Copies.push_back(std::move(Copy));
+  }
+
+  Out << "{\"traceEvents\":[";
+  const char *Separator = "\n";
+  for (size_t T = 0; T < Buffers.size(); ++T) {
+    unsigned Tid = Buffers[T]->Id;
+    if (const char *Name = Buffers[T]->Name.load(std::memory_order_relaxed)) {
+      Out << Separator << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+          << "\"tid\":" << Tid << ",\"args\":{\"name\":\"" << Name
+          << "\"}}";
+      Separator = ",\n";
+    }
+    for (const Event &E : Copies[T]) {
+      Out << Separator << "{\"name\":\"" << E.Name << "\",\"pid\":1,\"tid\":"
+          << Tid << ",\"ts\":";
+      printMicros(Out, E.Start - Origin);
+      if (E.Instant) {
+        Out << ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"value\":" << E.Value
+            << "}}";
+      } else {
+        Out << ",\"ph\":\"X\",\"dur\":";
+        printMicros(Out, E.Duration);
+        Out << "}";
+      }
+      Separator = ",\n";
+    }
+  }
+  Out << "\n]}\n";
+  return bool(Out);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Records where time goes, cheaply enough to leave in release builds. Each
+// thread writes to its own fixed-size ring buffer, so recording never locks
+// or allocates after a thread's first event, and the newest events are the
+// ones kept. Nothing is recorded until tracing is enabled, and until then
+// each probe costs one relaxed load.
+//
+// Event names must be string literals or otherwise outlive the trace.
+
+extern std::atomic<bool> TracingEnabled;
+
+inline bool tracingEnabled() {
+  return TracingEnabled.load(std::memory_order_relaxed);
+}
+void enableTracing(bool Enable);
+
+// Nanoseconds on a monotonic clock.
+uint64_t traceNow();
+
+// Records a span of time, from Start to End as returned by traceNow().
+void traceSpan(const char *Name, uint64_t Start, uint64_t End);
+// Records a point in time, with a number worth showing alongside it.
+void traceInstant(const char *Name, int64_t Value = 0);
+// Names the calling thread in the trace.
+void setTraceThreadName(const char *Name);
+
+// Writes every thread's buffered events in the Chrome trace event format,
+// which chrome://tracing and ui.perfetto.dev open. Safe to call while
+// other threads record; events they overwrite meanwhile, or are still
+// writing, are left out.
+bool writeChromeTrace(std::ostream &Out);
+
+// Records the lifetime of the scope as a span.
+class TraceScope {
+public:
+  explicit TraceScope(const char *Name)
+      : Name(tracingEnabled() ? Name : nullptr),
+        Start(this->Name ? traceNow() : 0) {}
+  ~TraceScope() {
+    if (Name) {
+      traceSpan(Name, Start, traceNow());
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  const char *Name;
+  uint64_t Start;
+};
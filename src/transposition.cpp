@@ -0,0 +1,34 @@
+#include "transposition.h"
+
+#include <cstring>
+
+TranspositionTable::TranspositionTable(unsigned Bits)
+    : Entries(new Entry[size_t(1) << Bits]), Mask((uint64_t(1) << Bits) - 1),
+      Probes(0), Hits(0) {
+  // Empty entries match no key but zero, which a hash almost never is.
+  for (uint64_t i = 0; i <= Mask; ++i) {
+    Entries[i].Check.store(0, std::memory_order_relaxed);
+    Entries[i].Score.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool TranspositionTable::probe(uint64_t Key, double &Score) {
+  Probes.fetch_add(1, std::memory_order_relaxed);
+  Entry &E = Entries[Key & Mask];
+  uint64_t Check = E.Check.load(std::memory_order_relaxed);
+  uint64_t Bits = E.Score.load(std::memory_order_relaxed);
+  if ((Check ^ Bits) != Key) {
+    return false;
+  }
+  Hits.fetch_add(1, std::memory_order_relaxed);
+  std::memcpy(&Score, &Bits, sizeof(Score));
+  return true;
+}
+
+void TranspositionTable::store(uint64_t Key, double Score) {
+  uint64_t Bits;
+  std::memcpy(&Bits, &Score, sizeof(Bits));
+  Entry &E = Entries[Key & Mask];
+  E.Check.store(Key ^ Bits, std::memory_order_relaxed);
+  E.Score.store(Bits, std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "board.h"
+#include "tetromino.h"
+
+// Zobrist hashing of search states: every feature a state can have gets a
+// fixed random key, and a state hashes to the XOR of its features' keys,
+// so that a change to a state updates its hash with an XOR or two. The
+// keys come from mixing the feature's number, which gives the same keys as
+// a table of random numbers would, on every run and platform, without one.
+inline uint64_t zobristKey(uint64_t Index) {
+  // splitmix64's finalizer.
+  uint64_t Z = (Index + 1) * 0x9E3779B97F4A7C15u;
+  Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9u;
+  Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBu;
+  return Z ^ (Z >> 31);
+}
+
+// A filled cell.
+inline uint64_t zobristCell(int Row, int Col) {
+  return zobristKey(uint64_t(Row) << 6 | Col);
+}
+
+// The piece in play, in its rotation (ShapeIndex).
+inline uint64_t zobristActive(Tetromino Piece) {
+  return zobristKey(0x10000 + Piece.getKind() * 4 + Piece.getRotation());
+}
+
+// The piece in the hold slot, or Tetromino::NumKinds for an empty one.
+inline uint64_t zobristHeld(Tetromino Piece) {
+  return zobristKey(0x10100 + Piece.getKind());
+}
+
+// Anything else a search's results depend on, numbered by the search.
+inline uint64_t zobristExtra(unsigned Index) {
+  return zobristKey(0x10200 + Index);
+}
+
+template <int NumRows, int NumCols>
+uint64_t zobristBoard(const BasicBoard<NumRows, NumCols> &Grid) {
+  uint64_t Hash = 0;
+  for (int Row = 0; Row < NumRows; ++Row) {
+    for (uint64_t Cells = Grid.getRow(Row); Cells; Cells &= Cells - 1) {
+      Hash ^= zobristCell(Row, __builtin_ctzll(Cells));
+    }
+  }
+  return Hash;
+}
+
+// A fixed-size table from search states' hashes to their scores, which any
+// number of search threads share without locking. Storing always replaces
+// whatever was in the entry, so the table forgets rather than grows.
+//
+// Each entry is two words, the key XORed with the score and the score, so
+// that an entry torn by two threads storing into it at once no longer
+// matches either key rather than handing one state's score to the other.
+class TranspositionTable {
+public:
+  // A table of 2^Bits entries, of 16 bytes each.
+  explicit TranspositionTable(unsigned Bits);
+
+  bool probe(uint64_t Key, double &Score);
+  void store(uint64_t Key, double Score);
+
+  uint64_t getProbes() const { return Probes.load(std::memory_order_relaxed); }
+  uint64_t getHits() const { return Hits.load(std::memory_order_relaxed); }
+  double getHitRate() const {
+    uint64_t N = getProbes();
+    return N ? double(getHits()) / N : 0;
+  }
+
+private:
+  struct Entry {
+    std::atomic<uint64_t> Check;
+    std::atomic<uint64_t> Score;
+  };
+
+  std::unique_ptr<Entry[]> Entries;
+  uint64_t Mask;
+  std::atomic<uint64_t> Probes;
+  std::atomic<uint64_t> Hits;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value of T from one writer thread to one reader thread
+// without locks. The writer fills a back buffer and publishes it; the
+// reader always sees the most recently published value, whole, and the
+// writer never waits for the reader to finish with it.
+template <typename T> class TripleBuffer {
+public:
+  TripleBuffer() : Buffers(), Back(0), Front(1), Middle(2) {}
+
+  // Writer only: the buffer to fill before the next publish().
+  T &back() { return Buffers[Back]; }
+  void publish() {
+    Back = Middle.exchange(Back | Fresh, std::memory_order_acq_rel) & Index;
+  }
+
+  // Reader only: the latest published value, which stays put until the
+  // next call.
+  const T &read() {
+    if (Middle.load(std::memory_order_relaxed) & Fresh) {
+      Front = Middle.exchange(Front, std::memory_order_acq_rel) & Index;
+    }
+    return Buffers[Front];
+  }
+
+private:
+  // The middle slot's index, with Fresh set while it holds a value the
+  // reader has not taken yet.
+  static const uint8_t Index = 3;
+  static const uint8_t Fresh = 4;
+
+  T Buffers[3];
+  uint8_t Back;
+  uint8_t Front;
+  std::atomic<uint8_t> Middle;
+};
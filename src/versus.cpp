@@ -0,0 +1,598 @@
+#include "versus.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sim_clock.h"
+
+namespace {
+
+enum DeltaFlags : uint8_t {
+  RowsChanged = 1,
+  PieceChanged = 2,
+  StatsChanged = 4,
+  GarbageChanged = 8,
+  IsGameOver = 16,
+};
+
+const uint8_t NoWinner = 0xFF;
+
+void putVarint(std::string &Out, uint64_t Value) {
+  do {
+    uint8_t Byte = Value & 0x7F;
+    Value >>= 7;
+    Out += char(Value ? Byte | 0x80 : Byte);
+  } while (Value);
+}
+
+bool getVarint(const uint8_t *&Data, const uint8_t *End, uint64_t &Value) {
+  Value = 0;
+  for (int Shift = 0; Shift < 64; Shift += 7) {
+    if (Data == End) {
+      return false;
+    }
+    uint8_t Byte = *Data++;
+    Value |= uint64_t(Byte & 0x7F) << Shift;
+    if (!(Byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Cells go over the wire as four bits each, two to a byte, and the rows
+// that changed as a 32-bit mask.
+static_assert(Board::Garbage < 16, "cell kinds must fit in a nibble");
+static_assert(Board::Cols % 2 == 0, "cells must pair up into bytes");
+static_assert(Board::Rows <= 32, "changed rows must fit in the row mask");
+
+bool setNonBlocking(int Fd) {
+  int Flags = fcntl(Fd, F_GETFL, 0);
+  return Flags >= 0 && fcntl(Fd, F_SETFL, Flags | O_NONBLOCK) == 0;
+}
+
+// Steps are small and frequent, and must not wait to be coalesced.
+void setNoDelay(int Fd) {
+  int One = 1;
+  setsockopt(Fd, IPPROTO_TCP, TCP_NODELAY, &One, sizeof(One));
+}
+
+std::string frame(char Type, const std::string &Body = std::string()) {
+  return char(Type) + Body;
+}
+
+} // end anonymous namespace
+
+unsigned versusAttack(unsigned Lines) {
+  static const unsigned Attack[] = {0, 0, 1, 2, 4};
+  return Attack[std::min(Lines, 4u)];
+}
+
+void VersusPlayerState::capture(const TetrisGame &Game, unsigned NewGarbage,
+                                bool Out) {
+  Grid = Game.getBoard();
+  Current = Game.getCurrent();
+  Next = Game.getNext();
+  Saved = Game.getSaved();
+  Pos = Game.getCurrentPos();
+  Score = Game.getScore();
+  Lines = Game.getLines();
+  Garbage = std::min(NewGarbage, 255u);
+  GameOver = Game.isGameOver() || Out;
+}
+
+bool VersusPlayerState::encodeDelta(uint8_t Player, VersusPlayerState &Old,
+                                    std::string &Out) const {
+  uint32_t ChangedRows = 0;
+  for (int Row = 0; Row < Board::Rows; ++Row) {
+    for (int Col = 0; Col < Board::Cols; ++Col) {
+      if (Grid.getCell(Row, Col) != Old.Grid.getCell(Row, Col)) {
+        ChangedRows |= 1u << Row;
+        break;
+      }
+    }
+  }
+  bool PieceMoved =
+      Current.getKind() != Old.Current.getKind() ||
+      Current.getRotation() != Old.Current.getRotation() ||
+      Next.getKind() != Old.Next.getKind() ||
+      Saved.getKind() != Old.Saved.getKind() || Pos.x != Old.Pos.x ||
+      Pos.y != Old.Pos.y;
+  bool Stats = Score != Old.Score || Lines != Old.Lines;
+
+  uint8_t Flags = (ChangedRows ? RowsChanged : 0) |
+                  (PieceMoved ? PieceChanged : 0) |
+                  (Stats ? StatsChanged : 0) |
+                  (Garbage != Old.Garbage ? GarbageChanged : 0) |
+                  (GameOver ? IsGameOver : 0);
+  if (Flags == (Old.GameOver ? IsGameOver : 0)) {
+    return false;
+  }
+
+  Out += char(Player);
+  Out += char(Flags);
+  if (ChangedRows) {
+    for (int i = 0; i < 4; ++i) {
+      Out += char(ChangedRows >> (8 * i));
+    }
+    for (uint32_t Rows = ChangedRows; Rows; Rows &= Rows - 1) {
+      int Row = __builtin_ctz(Rows);
+      for (int Col = 0; Col < Board::Cols; Col += 2) {
+        Out += char(Grid.getCell(Row, Col) | Grid.getCell(Row, Col + 1) << 4);
+      }
+    }
+  }
+  if (PieceMoved) {
+    Out += char(Current.getKind() | Current.getRotation() << 4);
+    Out += char(Next.getKind());
+    Out += char(Saved.getKind());
+    Out += char(Pos.x);
+    Out += char(Pos.y);
+  }
+  if (Stats) {
+    putVarint(Out, Score);
+    putVarint(Out, Lines);
+  }
+  if (Flags & GarbageChanged) {
+    Out += char(Garbage);
+  }
+  Old = *this;
+  return true;
+}
+
+bool VersusPlayerState::decodeDelta(const uint8_t *&Data,
+                                    const uint8_t *End) {
+  if (Data == End) {
+    return false;
+  }
+  uint8_t Flags = *Data++;
+  auto validKind = [](uint8_t Kind) { return Kind <= Tetromino::NumKinds; };
+
+  if (Flags & RowsChanged) {
+    if (End - Data < 4) {
+      return false;
+    }
+    uint32_t ChangedRows = 0;
+    for (int i = 0; i < 4; ++i) {
+      ChangedRows |= uint32_t(*Data++) << (8 * i);
+    }
+    if (ChangedRows >> Board::Rows) {
+      return false;
+    }
+    for (uint32_t Rows = ChangedRows; Rows; Rows &= Rows - 1) {
+      int Row = __builtin_ctz(Rows);
+      if (End - Data < Board::Cols / 2) {
+        return false;
+      }
+      for (int Col = 0; Col < Board::Cols; ++Col) {
+        uint8_t Cell = Data[Col / 2] >> (Col % 2 * 4) & 0xF;
+        if (Cell > Board::Garbage) {
+          return false;
+        }
+        Grid.setCell(Row, Col, Tetromino::Kind(Cell));
+      }
+      Data += Board::Cols / 2;
+    }
+  }
+  if (Flags & PieceChanged) {
+    if (End - Data < 5) {
+      return false;
+    }
+    uint8_t Kind = Data[0] & 0xF, Rotation = Data[0] >> 4;
+    if (!validKind(Kind) || !validKind(Data[1]) || !validKind(Data[2]) ||
+        (Kind != Tetromino::NumKinds &&
+         Rotation >= Tetromino(Tetromino::Kind(Kind)).getNumRotations())) {
+      return false;
+    }
+    Current = Tetromino(Tetromino::Kind(Kind), Rotation);
+    Next = Tetromino(Tetromino::Kind(Data[1]));
+    Saved = Tetromino(Tetromino::Kind(Data[2]));
+    Pos.x = int8_t(Data[3]);
+    Pos.y = int8_t(Data[4]);
+    Data += 5;
+  }
+  if (Flags & StatsChanged) {
+    if (!getVarint(Data, End, Score) || !getVarint(Data, End, Lines)) {
+      return false;
+    }
+  }
+  if (Flags & GarbageChanged) {
+    if (Data == End) {
+      return false;
+    }
+    Garbage = *Data++;
+  }
+  GameOver = Flags & IsGameOver;
+  return true;
+}
+
+bool VersusPlayerState::operator==(const VersusPlayerState &Other) const {
+  for (int Row = 0; Row < Board::Rows; ++Row) {
+    for (int Col = 0; Col < Board::Cols; ++Col) {
+      if (Grid.getCell(Row, Col) != Other.Grid.getCell(Row, Col)) {
+        return false;
+      }
+    }
+  }
+  return Current.getKind() == Other.Current.getKind() &&
+         Current.getRotation() == Other.Current.getRotation() &&
+         Next.getKind() == Other.Next.getKind() &&
+         Saved.getKind() == Other.Saved.getKind() && Pos.x == Other.Pos.x &&
+         Pos.y == Other.Pos.y && Score == Other.Score &&
+         Lines == Other.Lines && Garbage == Other.Garbage &&
+         GameOver == Other.GameOver;
+}
+
+Point VersusPlayerState::downDestination() const {
+  Point Result = Pos;
+  // The piece may overlap the stack once the game is over, and a
+  // malformed position is simply drawn where it is.
+  if (!GameOver && Current.isValid() && Pos.y >= 0 && Pos.y <= Board::Rows &&
+      Grid.fits(Current.getShape(), Pos.x, Pos.y)) {
+    Result.y = Grid.dropY(Current.getShape(), Pos.x, Pos.y);
+  }
+  return Result;
+}
+
+VersusConnection::VersusConnection(VersusConnection &&Other)
+    : Fd(Other.Fd), In(std::move(Other.In)), Read(Other.Read),
+      Out(std::move(Other.Out)) {
+  Other.Fd = -1;
+}
+
+VersusConnection &VersusConnection::operator=(VersusConnection &&Other) {
+  if (this != &Other) {
+    close();
+    Fd = Other.Fd;
+    In = std::move(Other.In);
+    Read = Other.Read;
+    Out = std::move(Other.Out);
+    Other.Fd = -1;
+  }
+  return *this;
+}
+
+void VersusConnection::close() {
+  if (Fd >= 0) {
+    ::close(Fd);
+    Fd = -1;
+  }
+}
+
+void VersusConnection::send(const std::string &Message) {
+  assert(Message.size() <= 0xFFFF);
+  Out += char(Message.size());
+  Out += char(Message.size() >> 8);
+  Out += Message;
+}
+
+bool VersusConnection::flush() {
+  size_t Sent = 0;
+  while (Fd >= 0 && Sent < Out.size()) {
+    ssize_t N = ::send(Fd, Out.data() + Sent, Out.size() - Sent, MSG_NOSIGNAL);
+    if (N < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      close();
+      return false;
+    }
+    Sent += N;
+  }
+  Out.erase(0, Sent);
+  return Fd >= 0;
+}
+
+bool VersusConnection::receive() {
+  char Buffer[4096];
+  while (Fd >= 0) {
+    ssize_t N = ::recv(Fd, Buffer, sizeof(Buffer), 0);
+    if (N > 0) {
+      In.append(Buffer, N);
+      continue;
+    }
+    if (N < 0 && errno == EINTR) {
+      continue;
+    }
+    if (N < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    close();
+  }
+  return Fd >= 0;
+}
+
+bool VersusConnection::nextMessage(std::string &Message) {
+  if (In.size() - Read < 2) {
+    In.erase(0, Read);
+    Read = 0;
+    return false;
+  }
+  size_t Size = uint8_t(In[Read]) | uint8_t(In[Read + 1]) << 8;
+  if (In.size() - Read - 2 < Size) {
+    In.erase(0, Read);
+    Read = 0;
+    return false;
+  }
+  Message.assign(In, Read + 2, Size);
+  Read += 2 + Size;
+  return true;
+}
+
+VersusServer::VersusServer(uint64_t Seed, PieceGenerator::Policy Policy)
+    : Seed(Seed), Policy(Policy), ListenFd(-1), Port(0), Holes(Seed),
+      Ticks(0), Winner(-1), Over(false), BytesPerClient(0),
+      GarbageRows(0) {}
+
+VersusServer::~VersusServer() {
+  if (ListenFd >= 0) {
+    ::close(ListenFd);
+  }
+}
+
+bool VersusServer::listen(uint16_t NewPort, bool Loopback) {
+  ListenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (ListenFd < 0) {
+    return false;
+  }
+  int One = 1;
+  setsockopt(ListenFd, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+  sockaddr_in Addr = {};
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons(NewPort);
+  Addr.sin_addr.s_addr = htonl(Loopback ? INADDR_LOOPBACK : INADDR_ANY);
+  socklen_t Size = sizeof(Addr);
+  if (bind(ListenFd, (sockaddr *)&Addr, sizeof(Addr)) != 0 ||
+      ::listen(ListenFd, VersusMaxPlayers) != 0 ||
+      !setNonBlocking(ListenFd) ||
+      getsockname(ListenFd, (sockaddr *)&Addr, &Size) != 0) {
+    return false;
+  }
+  Port = ntohs(Addr.sin_port);
+  return true;
+}
+
+unsigned VersusServer::accept() {
+  while (Clients.size() < VersusMaxPlayers && Games.empty()) {
+    int Fd = ::accept(ListenFd, nullptr, nullptr);
+    if (Fd < 0) {
+      break;
+    }
+    if (!setNonBlocking(Fd)) {
+      ::close(Fd);
+      continue;
+    }
+    setNoDelay(Fd);
+    Clients.emplace_back(Fd);
+  }
+  return Clients.size();
+}
+
+void VersusServer::start() {
+  assert(Games.empty());
+  Games.assign(Clients.size(), TetrisGame(Policy));
+  for (TetrisGame &Game : Games) {
+    Game.reset(Seed, Policy);
+  }
+  Sent.assign(Clients.size(), VersusPlayerState());
+  Pending.assign(Clients.size(), 0);
+  for (size_t i = 0; i < Clients.size(); ++i) {
+    Clients[i].send(frame('W', std::string{char(i), char(Clients.size())}));
+    Clients[i].flush();
+  }
+}
+
+bool VersusServer::isOut(unsigned Player) const {
+  return Games[Player].isGameOver() || !Clients[Player].isOpen();
+}
+
+// Works out the attacks and garbage due after Player's game changed from
+// having placed PiecesBefore pieces and cleared LinesBefore lines.
+void VersusServer::settle(unsigned Player, uint64_t PiecesBefore,
+                          uint64_t LinesBefore) {
+  TetrisGame &Game = Games[Player];
+  if (Game.getPiecesPlaced() == PiecesBefore) {
+    return;
+  }
+  unsigned Cleared = Game.getLines() - LinesBefore;
+  unsigned Attack = versusAttack(Cleared);
+  if (Cleared) {
+    // Clearing lines first cancels garbage on its way, and only what is
+    // left over goes to the next player still standing.
+    unsigned Cancelled = std::min(Attack, Pending[Player]);
+    Pending[Player] -= Cancelled;
+    Attack -= Cancelled;
+    for (unsigned i = 1; Attack && i < Games.size(); ++i) {
+      unsigned Target = (Player + i) % Games.size();
+      if (!isOut(Target)) {
+        Pending[Target] += Attack;
+        break;
+      }
+    }
+  } else if (Pending[Player]) {
+    // Garbage lands when a piece locks without clearing anything, with
+    // one gap shared by all of it.
+    int Count = std::min<unsigned>(Pending[Player], Board::Rows);
+    Game.addGarbage(Count, Holes.between(0, Board::Cols - 1));
+    Pending[Player] = 0;
+    GarbageRows += Count;
+  }
+}
+
+bool VersusServer::tick() {
+  if (Over) {
+    return false;
+  }
+
+  std::string Message;
+  for (unsigned i = 0; i < Clients.size(); ++i) {
+    Clients[i].receive();
+    while (Clients[i].nextMessage(Message)) {
+      // Players cannot pause a match.
+      if (Message.size() != 2 || Message[0] != 'I' ||
+          uint8_t(Message[1]) >= uint8_t(Action::Pause)) {
+        continue;
+      }
+      TetrisGame &Game = Games[i];
+      uint64_t Pieces = Game.getPiecesPlaced(), Lines = Game.getLines();
+      Game.apply(Action(Message[1]));
+      settle(i, Pieces, Lines);
+    }
+  }
+  for (unsigned i = 0; i < Games.size(); ++i) {
+    TetrisGame &Game = Games[i];
+    uint64_t Pieces = Game.getPiecesPlaced(), Lines = Game.getLines();
+    Game.step(SimClock::StepTicks);
+    settle(i, Pieces, Lines);
+  }
+  ++Ticks;
+
+  // One message for everyone, holding only the games that changed.
+  std::string Step = frame('T');
+  for (int i = 0; i < 4; ++i) {
+    Step += char(Ticks >> (8 * i));
+  }
+  Step += char(0);
+  uint8_t Changed = 0;
+  VersusPlayerState Now;
+  for (unsigned i = 0; i < Games.size(); ++i) {
+    Now.capture(Games[i], Pending[i], !Clients[i].isOpen());
+    Changed += Now.encodeDelta(i, Sent[i], Step);
+  }
+  Step[5] = char(Changed);
+  broadcast(Step);
+  BytesPerClient += Step.size() + 2;
+
+  unsigned Standing = 0;
+  int Last = -1;
+  for (unsigned i = 0; i < Games.size(); ++i) {
+    if (!isOut(i)) {
+      ++Standing;
+      Last = i;
+    }
+  }
+  if (Standing > (Games.size() > 1 ? 1u : 0u)) {
+    return true;
+  }
+  Winner = Games.size() > 1 ? Last : -1;
+  broadcast(frame('E', std::string(1, char(Winner < 0 ? NoWinner : Winner))));
+  Over = true;
+  return false;
+}
+
+void VersusServer::broadcast(const std::string &Message) {
+  for (VersusConnection &Client : Clients) {
+    if (Client.isOpen()) {
+      Client.send(Message);
+      Client.flush();
+    }
+  }
+}
+
+bool VersusClient::connect(const std::string &Host, uint16_t Port) {
+  addrinfo Hints = {};
+  Hints.ai_family = AF_UNSPEC;
+  Hints.ai_socktype = SOCK_STREAM;
+  addrinfo *Addresses;
+  std::string Service = std::to_string(Port);
+  if (getaddrinfo(Host.c_str(), Service.c_str(), &Hints, &Addresses) != 0) {
+    return false;
+  }
+  int Fd = -1;
+  for (addrinfo *A = Addresses; A; A = A->ai_next) {
+    Fd = socket(A->ai_family, A->ai_socktype, A->ai_protocol);
+    if (Fd < 0) {
+      continue;
+    }
+    if (::connect(Fd, A->ai_addr, A->ai_addrlen) == 0) {
+      break;
+    }
+    ::close(Fd);
+    Fd = -1;
+  }
+  freeaddrinfo(Addresses);
+  if (Fd < 0 || !setNonBlocking(Fd)) {
+    if (Fd >= 0) {
+      ::close(Fd);
+    }
+    return false;
+  }
+  setNoDelay(Fd);
+  Server = VersusConnection(Fd);
+  return true;
+}
+
+void VersusClient::sendInput(Action A) {
+  Server.send(frame('I', std::string(1, char(A))));
+  Server.flush();
+}
+
+bool VersusClient::poll() {
+  bool Open = Server.receive();
+  std::string Message;
+  while (Server.nextMessage(Message)) {
+    if (!handle(Message)) {
+      Server.close();
+      return false;
+    }
+  }
+  return Open;
+}
+
+bool VersusClient::handle(const std::string &Message) {
+  const uint8_t *Data = (const uint8_t *)Message.data();
+  const uint8_t *End = Data + Message.size();
+  if (Data == End) {
+    return false;
+  }
+  switch (*Data++) {
+  case 'W':
+    if (End - Data != 2 || Data[0] >= Data[1] ||
+        Data[1] > VersusMaxPlayers) {
+      return false;
+    }
+    Player = Data[0];
+    Players.assign(Data[1], VersusPlayerState());
+    return true;
+  case 'T': {
+    if (End - Data < 5 || !isStarted()) {
+      return false;
+    }
+    Tick = Data[0] | Data[1] << 8 | Data[2] << 16 | uint32_t(Data[3]) << 24;
+    unsigned Count = Data[4];
+    Data += 5;
+    for (unsigned i = 0; i < Count; ++i) {
+      if (Data == End || *Data >= Players.size()) {
+        return false;
+      }
+      unsigned Index = *Data++;
+      if (!Players[Index].decodeDelta(Data, End)) {
+        return false;
+      }
+    }
+    return Data == End;
+  }
+  case 'E':
+    if (End - Data != 1) {
+      return false;
+    }
+    Winner = *Data == NoWinner ? -1 : *Data;
+    Over = true;
+    return true;
+  default:
+    return false;
+  }
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "game.h"
+#include "random.h"
+
+// Head-to-head games over TCP. The server runs every player's TetrisGame
+// and is the only one that does: clients send nothing but their inputs, and
+// the server sends back, every step, what changed in each game since the
+// step before.
+//
+// Every message is framed by its length as 2 little-endian bytes, and
+// starts with a type byte:
+//
+//   client to server:
+//     'I' action        an input for the sender's game
+//   server to client:
+//     'W' player count  the match has started, and which player you are
+//     'T' tick(4) count delta...
+//                       one step of the match, with a delta for each game
+//                       that changed in it
+//     'E' winner        the match is over; 0xFF if nobody won
+//
+// A delta is the player, a byte of flags, then the parts the flags name:
+// the rows that changed as a 4-byte mask followed by five bytes per row,
+// two cells per byte; the current piece's kind and rotation, the next and
+// held kinds and the piece's position, a byte each; the score and lines as
+// varints; and the garbage waiting to be added. Nothing is sent for a game
+// that did not change, so a step costs about the same however many players
+// there are.
+
+static const unsigned VersusMaxPlayers = 64;
+
+// Lines sent to opponents by a lock that clears Lines rows.
+unsigned versusAttack(unsigned Lines);
+
+// What the clients know about one player's game. Drawing code can use it
+// in place of a TetrisGame.
+class VersusPlayerState {
+public:
+  VersusPlayerState()
+      : Current(Tetromino::NumKinds), Next(Tetromino::NumKinds),
+        Saved(Tetromino::NumKinds), Pos{0, 0}, Score(0), Lines(0),
+        Garbage(0), GameOver(false) {}
+
+  // Takes the state of Game, along with Garbage lines waiting for it.
+  void capture(const TetrisGame &Game, unsigned Garbage, bool Out);
+
+  // Appends the changes from Old to this state to Out, and updates Old to
+  // match. Returns false, appending nothing, if there were none.
+  bool encodeDelta(uint8_t Player, VersusPlayerState &Old,
+                   std::string &Out) const;
+  // Applies a delta encoded by encodeDelta(), with the player byte already
+  // read. Returns false if it is malformed.
+  bool decodeDelta(const uint8_t *&Data, const uint8_t *End);
+
+  bool operator==(const VersusPlayerState &Other) const;
+
+  const Board &getBoard() const { return Grid; }
+  Tetromino getCurrent() const { return Current; }
+  Tetromino getNext() const { return Next; }
+  Tetromino getSaved() const { return Saved; }
+  Point getCurrentPos() const { return Pos; }
+  Point downDestination() const;
+  uint64_t getScore() const { return Score; }
+  uint64_t getLines() const { return Lines; }
+  unsigned getGarbage() const { return Garbage; }
+  bool isGameOver() const { return GameOver; }
+
+private:
+  Board Grid;
+  Tetromino Current;
+  Tetromino Next;
+  Tetromino Saved;
+  Point Pos;
+  uint64_t Score;
+  uint64_t Lines;
+  uint8_t Garbage;
+  bool GameOver;
+};
+
+// A non-blocking TCP connection carrying length-framed messages.
+class VersusConnection {
+public:
+  explicit VersusConnection(int Fd = -1) : Fd(Fd), Read(0) {}
+  VersusConnection(VersusConnection &&Other);
+  VersusConnection &operator=(VersusConnection &&Other);
+  ~VersusConnection() { close(); }
+
+  bool isOpen() const { return Fd >= 0; }
+  void close();
+
+  // Queues a message; flush() sends what the socket will take.
+  void send(const std::string &Message);
+  bool flush();
+  // Reads what has arrived, then hands out one complete message at a time.
+  // Returns false, closing the connection, once the other end has gone.
+  bool receive();
+  bool nextMessage(std::string &Message);
+
+private:
+  int Fd;
+  std::string In;
+  size_t Read;
+  std::string Out;
+};
+
+// Runs a match for whoever connects before it starts.
+class VersusServer {
+public:
+  // Every player gets the same pieces, dealt from Seed.
+  VersusServer(uint64_t Seed, PieceGenerator::Policy Policy);
+  ~VersusServer();
+
+  // Listens on Port, or on any free port if it is 0, on every interface
+  // unless Loopback is set.
+  bool listen(uint16_t Port, bool Loopback = false);
+  uint16_t getPort() const { return Port; }
+
+  // Accepts every connection that is waiting, and returns how many players
+  // there are.
+  unsigned accept();
+  void start();
+  // Applies the inputs that have arrived, advances every game by one
+  // SimClock step and broadcasts what changed. Returns false once at most
+  // one player is left standing, after telling everyone who won.
+  bool tick();
+
+  unsigned getNumPlayers() const { return Clients.size(); }
+  const TetrisGame &getGame(unsigned Player) const { return Games[Player]; }
+  // What the clients have been told about a player's game.
+  const VersusPlayerState &getSent(unsigned Player) const {
+    return Sent[Player];
+  }
+  // -1 until the match is over, and if it ended with nobody standing.
+  int getWinner() const { return Winner; }
+  uint64_t getTicks() const { return Ticks; }
+  // Bytes of step messages sent to each client so far.
+  uint64_t getBytesPerClient() const { return BytesPerClient; }
+  // Garbage rows added to every game so far.
+  uint64_t getGarbageRows() const { return GarbageRows; }
+
+private:
+  uint64_t Seed;
+  PieceGenerator::Policy Policy;
+  int ListenFd;
+  uint16_t Port;
+  Random Holes;
+
+  std::vector<VersusConnection> Clients;
+  std::vector<TetrisGame> Games;
+  std::vector<VersusPlayerState> Sent;
+  std::vector<unsigned> Pending;
+  uint64_t Ticks;
+  int Winner;
+  bool Over;
+  uint64_t BytesPerClient;
+  uint64_t GarbageRows;
+
+  bool isOut(unsigned Player) const;
+  void settle(unsigned Player, uint64_t PiecesBefore, uint64_t LinesBefore);
+  void broadcast(const std::string &Message);
+};
+
+// One player's end of a match.
+class VersusClient {
+public:
+  VersusClient() : Player(-1), Winner(-1), Over(false), Tick(0) {}
+
+  bool connect(const std::string &Host, uint16_t Port);
+  void sendInput(Action A);
+  // Applies whatever the server has sent, without waiting for more.
+  // Returns false once the connection is gone.
+  bool poll();
+
+  bool isStarted() const { return Player >= 0; }
+  int getPlayer() const { return Player; }
+  const std::vector<VersusPlayerState> &getPlayers() const { return Players; }
+  bool isOver() const { return Over; }
+  int getWinner() const { return Winner; }
+  uint32_t getTick() const { return Tick; }
+
+private:
+  VersusConnection Server;
+  std::vector<VersusPlayerState> Players;
+  int Player;
+  int Winner;
+  bool Over;
+  uint32_t Tick;
+
+  bool handle(const std::string &Message);
+};
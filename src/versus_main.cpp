@@ -0,0 +1,178 @@
+// Serves versus matches over TCP, or plays one against itself over
+// loopback to check that every client ends up seeing exactly what the
+// server's games hold, and to measure what each step costs.
+//
+// Usage: tetris_versus --serve PORT PLAYERS [--seed N] [--seven-bag]
+//        tetris_versus --loopback PLAYERS [--max-ticks N] [--seed N]
+//                      [--seven-bag]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "autoplayer.h"
+#include "random.h"
+#include "sim_clock.h"
+#include "versus.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int serve(uint16_t Port, unsigned Players, uint64_t Seed,
+          PieceGenerator::Policy Policy) {
+  VersusServer Server(Seed, Policy);
+  if (!Server.listen(Port)) {
+    std::cerr << "cannot listen on port " << Port << '\n';
+    return 1;
+  }
+  std::cerr << "waiting for " << Players << " players on port "
+            << Server.getPort() << '\n';
+  while (Server.accept() < Players) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  Server.start();
+
+  // Steps run in real time, one SimClock step apart.
+  const auto Period = std::chrono::microseconds(SimClock::StepTicks);
+  auto Next = Clock::now();
+  while (Server.tick()) {
+    Next += Period;
+    auto Now = Clock::now();
+    if (Next < Now) {
+      Next = Now;
+    }
+    std::this_thread::sleep_until(Next);
+  }
+  std::cout << "winner: " << Server.getWinner() << '\n';
+  return 0;
+}
+
+// Runs a whole match as fast as it will go, with simulated clients that
+// connect over loopback and send only inputs. They pick them by looking at
+// the server's games, which is only possible because everything runs on
+// this one thread.
+int loopback(unsigned Players, uint64_t MaxTicks, uint64_t Seed,
+             PieceGenerator::Policy Policy) {
+  VersusServer Server(Seed, Policy);
+  if (!Server.listen(0, true)) {
+    std::cerr << "cannot listen on loopback\n";
+    return 1;
+  }
+  std::vector<VersusClient> Clients(Players);
+  for (VersusClient &Client : Clients) {
+    if (!Client.connect("127.0.0.1", Server.getPort())) {
+      std::cerr << "cannot connect to port " << Server.getPort() << '\n';
+      return 1;
+    }
+  }
+  while (Server.accept() < Players) {
+    std::this_thread::yield();
+  }
+  Server.start();
+
+  // Players move at different paces, so that games that start alike soon
+  // differ and someone wins.
+  Autoplayer::Options Opts;
+  Opts.Lookahead = false;
+  std::vector<std::unique_ptr<Autoplayer>> AIs;
+  for (unsigned i = 0; i < Players; ++i) {
+    AIs.emplace_back(new Autoplayer(Opts));
+  }
+
+  Clock::duration ServerTime(0);
+  bool Running = true;
+  while (Running && Server.getTicks() < MaxTicks) {
+    for (unsigned i = 0; i < Players; ++i) {
+      Clients[i].poll();
+      const TetrisGame &Game = Server.getGame(i);
+      if (Server.getTicks() % (10 + i) == 0 && !Game.isGameOver()) {
+        Clients[i].sendInput(AIs[i]->nextAction(Game));
+      }
+    }
+    Clock::time_point Start = Clock::now();
+    Running = Server.tick();
+    ServerTime += Clock::now() - Start;
+  }
+
+  // Let every client catch up with the last step.
+  Clock::time_point Deadline = Clock::now() + std::chrono::seconds(5);
+  for (VersusClient &Client : Clients) {
+    while (Client.poll() && Client.getTick() < Server.getTicks() &&
+           Clock::now() < Deadline) {
+      std::this_thread::yield();
+    }
+  }
+
+  int Failures = 0;
+  for (unsigned c = 0; c < Players; ++c) {
+    for (unsigned p = 0; p < Players; ++p) {
+      VersusPlayerState Truth;
+      Truth.capture(Server.getGame(p), Server.getSent(p).getGarbage(), false);
+      if (!(Clients[c].getPlayers()[p] == Truth)) {
+        std::cerr << "client " << c << " is wrong about player " << p << '\n';
+        ++Failures;
+      }
+    }
+  }
+
+  double Ticks = Server.getTicks();
+  double FullState = Board::Rows * Board::Cols / 2 + 8;
+  std::cout << "{\"players\": " << Players << ", \"ticks\": " << Ticks
+            << ", \"winner\": " << Server.getWinner()
+            << ", \"garbage_rows\": " << Server.getGarbageRows()
+            << ", \"bytes_per_tick_per_player\": "
+            << Server.getBytesPerClient() / Ticks / Players
+            << ", \"full_state_bytes_per_player\": " << FullState
+            << ", \"server_us_per_tick\": "
+            << std::chrono::duration<double, std::micro>(ServerTime).count() /
+                   Ticks
+            << ", \"mismatches\": " << Failures << "}\n";
+  return Failures ? 1 : 0;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  uint64_t Seed = randomSeed();
+  PieceGenerator::Policy Policy = PieceGenerator::Uniform;
+  uint64_t MaxTicks = 10 * 60 * 1000;
+  int Port = -1;
+  unsigned Players = 0;
+  bool Loopback = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string Arg = argv[i];
+    if (Arg == "--serve" && i + 2 < argc) {
+      Port = std::atoi(argv[++i]);
+      Players = std::atoi(argv[++i]);
+    } else if (Arg == "--loopback" && i + 1 < argc) {
+      Loopback = true;
+      Players = std::atoi(argv[++i]);
+    } else if (Arg == "--max-ticks" && i + 1 < argc) {
+      MaxTicks = std::strtoull(argv[++i], nullptr, 10);
+    } else if (Arg == "--seed" && i + 1 < argc) {
+      Seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (Arg == "--seven-bag") {
+      Policy = PieceGenerator::SevenBag;
+    } else {
+      Players = 0;
+      break;
+    }
+  }
+  if (!Players || Players > VersusMaxPlayers || (!Loopback && Port < 0) ||
+      Port > 0xFFFF) {
+    std::cerr << "usage: tetris_versus --serve PORT PLAYERS [--seed N] "
+                 "[--seven-bag]\n"
+                 "       tetris_versus --loopback PLAYERS [--max-ticks N] "
+                 "[--seed N] [--seven-bag]\n";
+    return 1;
+  }
+  if (Loopback) {
+    return loopback(Players, MaxTicks, Seed, Policy);
+  }
+  return serve(Port, Players, Seed, Policy);
+}